@@ -0,0 +1,187 @@
+/**
+ * @file   cm.c
+ *
+ * @section DESCRIPTION
+ *
+ * Contention management: per-thread abort history kept across the attempts of a transaction,
+ * backoff before retries, priority-based resolution of conflicts on held stripe locks and queuing
+ * of repeat conflicters behind the transaction they conflict with.
+**/
+
+#include "cm.h"
+#include "ebr.h"
+
+static struct cm_thread_t cm_threads[EBR_MAX_THREADS + 1];     // Indexed by thread id
+static _Atomic uint64_t cm_tickets;                             // Greedy timestamps
+static pthread_once_t cm_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Have cm_thread_init called on every thread id handed out
+ */
+static void cm_set_hook(void);
+
+/**
+ * Reset the record of a thread id handed out to a new thread, so that it inherits nothing of the previous holder
+ * @param self thread id (see ebr_thread_id)
+ */
+static void cm_thread_init(unsigned self);
+
+/**
+ * @return Priority of the current attempt of thread, higher wins
+ */
+static uint64_t cm_priority(enum cm_policy_t policy, struct cm_thread_t *thread, uint64_t work);
+
+/**
+ * Spin a random number of pauses, up to a bound doubling with each consecutive abort
+ */
+static void cm_backoff(struct cm_thread_t *thread);
+
+/**
+ * Yield until the transaction the enemy of thread ran at the last conflict ended, a bounded number of times
+ */
+static void cm_queue(struct cm_thread_t *thread);
+
+// ============================================= global functions =============================================
+
+enum cm_policy_t cm_policy_select(void) {
+    static char const *const names[] = { [CM_NONE] = "none", [CM_BACKOFF] = "backoff", [CM_SERIALIZE] = "serialize", [CM_KARMA] = "karma", [CM_GREEDY] = "greedy", [CM_LONG] = "long" };
+
+    pthread_once(&cm_once, cm_set_hook);
+
+    char const *setting = getenv(CM_ENV);
+    if (likely(!setting)) return CM_NONE;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(names[i], setting) == 0) return (enum cm_policy_t) i;
+    }
+    LOG_WARNING("cm_policy_select: unknown %s '%s', using none\n", CM_ENV, setting);
+    return CM_NONE;
+}
+
+void cm_begin(enum cm_policy_t policy, unsigned self) {
+    if (likely(policy == CM_NONE)) return;
+    struct cm_thread_t *thread = &cm_threads[self];
+
+    if (policy == CM_SERIALIZE) {
+        // Run back-to-back with the enemy rather than abort each other again
+        if (thread->repeats >= CM_SERIALIZE_REPEATS) cm_queue(thread);
+        else if (thread->aborts > 0) cm_backoff(thread);
+        atomic_fetch_add_explicit(&thread->sequence, 1, memory_order_release);
+        return;
+    }
+    if (thread->aborts == 0) {
+        if (policy == CM_GREEDY) thread->birth = atomic_fetch_add(&cm_tickets, 1);
+        return;
+    }
+    if (policy == CM_BACKOFF || policy == CM_KARMA) cm_backoff(thread);
+}
+
+void cm_publish(enum cm_policy_t policy, unsigned self, uint64_t work) {
+    if (likely(policy < CM_KARMA)) return;
+    struct cm_thread_t *thread = &cm_threads[self];
+    atomic_store_explicit(&thread->priority, cm_priority(policy, thread, work), memory_order_relaxed);
+}
+
+bool cm_wait(enum cm_policy_t policy, unsigned self, uint64_t work, v_lock_t *lock) {
+    if (likely(policy < CM_KARMA)) return false;
+
+    unsigned owner = v_lock_owner(lock);
+    if (owner == 0) return true;
+    if (owner == self) return false;
+
+    // Ties go to the lower thread id, so that two transactions never wait for each other
+    uint64_t mine = cm_priority(policy, &cm_threads[self], work);
+    uint64_t theirs = atomic_load_explicit(&cm_threads[owner].priority, memory_order_relaxed);
+    if (mine < theirs || (mine == theirs && self > owner)) return false;
+
+    for (unsigned i = 0; i < CM_WAIT_SPINS; i++) {
+        if (v_lock_owner(lock) != owner) return true;
+        spin_pause();
+    }
+    return false;
+}
+
+void cm_conflict(enum cm_policy_t policy, unsigned self, v_lock_t *lock, stripe_t stripe) {
+    if (likely(policy != CM_SERIALIZE)) return;
+
+    unsigned owner = v_lock_owner(lock);
+    if (owner == 0 || owner == self) return;
+    struct cm_thread_t *thread = &cm_threads[self];
+    thread->repeats = (owner == thread->enemy || stripe == thread->stripe) ? thread->repeats + 1 : 1;
+    thread->enemy = owner;
+    thread->stripe = stripe;
+    thread->enemy_sequence = atomic_load_explicit(&cm_threads[owner].sequence, memory_order_acquire);
+}
+
+void cm_abort(enum cm_policy_t policy, unsigned self, uint64_t work) {
+    if (likely(policy == CM_NONE)) return;
+    struct cm_thread_t *thread = &cm_threads[self];
+    thread->aborts++;
+    thread->karma += work;
+    if (policy == CM_SERIALIZE) atomic_fetch_add_explicit(&thread->sequence, 1, memory_order_release);
+}
+
+void cm_commit(enum cm_policy_t policy, unsigned self) {
+    if (likely(policy == CM_NONE)) return;
+    struct cm_thread_t *thread = &cm_threads[self];
+    thread->aborts = 0;
+    thread->karma = 0;
+    if (policy == CM_SERIALIZE) {
+        // A pair that keeps conflicting stays queued, an isolated conflict is forgotten
+        thread->repeats >>= 1;
+        atomic_fetch_add_explicit(&thread->sequence, 1, memory_order_release);
+    }
+}
+
+// ============================================= static functions implementation =============================================
+static void cm_set_hook(void) {
+    ebr_set_register_hook(cm_thread_init);
+}
+
+static void cm_thread_init(unsigned self) {
+    struct cm_thread_t *thread = &cm_threads[self];
+    atomic_store_explicit(&thread->priority, 0, memory_order_relaxed);
+    // The sequence keeps counting (and ends even) so that threads queued behind the previous holder see it change
+    if (atomic_load_explicit(&thread->sequence, memory_order_relaxed) & 1) atomic_fetch_add_explicit(&thread->sequence, 1, memory_order_release);
+    thread->aborts = 0;
+    thread->karma = 0;
+    thread->birth = 0;
+    thread->seed = 0;
+    thread->enemy = 0;
+    thread->enemy_sequence = 0;
+    thread->stripe = CM_NO_STRIPE;
+    thread->repeats = 0;
+}
+
+static uint64_t cm_priority(enum cm_policy_t policy, struct cm_thread_t *thread, uint64_t work) {
+    switch (policy) {
+    case CM_KARMA:  return thread->karma + work;
+    case CM_GREEDY: return UINT64_MAX - thread->birth;
+    case CM_LONG:   return work;
+    default:        return 0;
+    }
+}
+
+static void cm_backoff(struct cm_thread_t *thread) {
+    unsigned shift = thread->aborts - 1 < CM_BACKOFF_MAX_SHIFT ? thread->aborts - 1 : CM_BACKOFF_MAX_SHIFT;
+    uint32_t limit = (uint32_t) CM_BACKOFF_MIN_SPINS << shift;
+
+    // xorshift32, seeded per record
+    uint32_t x = thread->seed ? thread->seed : (uint32_t) (uintptr_t) thread | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    thread->seed = x;
+
+    for (uint32_t spins = x % limit; spins > 0; spins--) spin_pause();
+}
+
+static void cm_queue(struct cm_thread_t *thread) {
+    // An even sequence means the enemy was between transactions: nothing to queue behind
+    if ((thread->enemy_sequence & 1) == 0) return;
+
+    struct cm_thread_t *enemy = &cm_threads[thread->enemy];
+    for (unsigned i = 0; i < CM_QUEUE_YIELDS; i++) {
+        if (atomic_load_explicit(&enemy->sequence, memory_order_acquire) != thread->enemy_sequence) return;
+        sched_yield();
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "v_lock.h"
+#include "macros.h"
+
+/**
+ * @brief Contention management policies (CM_ENV), deciding what a transaction does when it meets a stripe
+ * locked by another one, and how long an aborted transaction waits before its retry.
+ */
+enum cm_policy_t {
+    CM_NONE,        // Abort at once, retry at once
+    CM_BACKOFF,     // Abort at once, the retry waits a randomized exponential delay
+    CM_SERIALIZE,   // As backoff, but a thread that keeps conflicting with the same thread or stripe starts its next attempt once that thread's transaction ended
+    CM_KARMA,       // Polka: the transaction that did more work (across its aborted attempts) waits, the other backs off
+    CM_GREEDY,      // The older transaction (first attempt started earlier) waits, the younger aborts
+    CM_LONG,        // The transaction whose current attempt did more work waits, the shorter aborts
+};
+
+/**
+ * @brief Contention state of a thread, kept across the attempts of its transactions.
+ * Records are indexed by thread id (see ebr_thread_id); other threads only read the priority and the sequence.
+ * @param priority published when the thread locks stripes, compared by the transactions that meet its locks
+ * @param sequence incremented when an attempt starts and when it ends (serialize): odd while one runs
+ * @param aborts   consecutive aborts of the current transaction
+ * @param karma    work done by the aborted attempts of the current transaction
+ * @param birth    ticket of the first attempt of the current transaction (greedy)
+ * @param seed     state of the backoff random generator
+ * @param enemy    thread holding the lock of the last conflict (serialize)
+ * @param enemy_sequence sequence of the enemy at the last conflict
+ * @param stripe   stripe of the last conflict, CM_NO_STRIPE before the first one
+ * @param repeats  conflicts in a row with the same enemy or stripe, halved by each commit
+ */
+struct cm_thread_t {
+    _Alignas(CM_CACHE_LINE) _Atomic uint64_t priority;
+    _Atomic uint64_t sequence;
+    unsigned aborts;
+    uint64_t karma;
+    uint64_t birth;
+    uint32_t seed;
+    unsigned enemy;
+    uint64_t enemy_sequence;
+    stripe_t stripe;
+    unsigned repeats;
+};
+
+/**
+ * Select the contention management policy of a new region (the first call also has the records of
+ * thread ids reset whenever an id is handed out, see ebr_set_register_hook)
+ * @return Policy named by CM_ENV, CM_NONE if it is unset or unknown
+ */
+enum cm_policy_t cm_policy_select(void);
+
+/**
+ * Start an attempt of a transaction of thread self: backs off first if the previous attempt aborted,
+ * or queues behind the transaction it keeps conflicting with (serialize)
+ */
+void cm_begin(enum cm_policy_t policy, unsigned self);
+
+/**
+ * Publish the priority of thread self before it locks stripes
+ * @param work words accessed so far by the current attempt
+ */
+void cm_publish(enum cm_policy_t policy, unsigned self, uint64_t work);
+
+/**
+ * Resolve a conflict on a lock held by another thread: wait (a bounded time) for its release if
+ * thread self has the priority
+ * @param work words accessed so far by the current attempt
+ * @return Whether the holder released the lock, so that the access can be tried again
+ */
+bool cm_wait(enum cm_policy_t policy, unsigned self, uint64_t work, v_lock_t *lock);
+
+/**
+ * Record the conflict that makes the current attempt of thread self abort (serialize)
+ * @param lock   lock of the stripe, held by another thread
+ * @param stripe index of the stripe
+ */
+void cm_conflict(enum cm_policy_t policy, unsigned self, v_lock_t *lock, stripe_t stripe);
+
+/**
+ * Record that the current attempt of thread self aborted
+ * @param work words accessed by the attempt
+ */
+void cm_abort(enum cm_policy_t policy, unsigned self, uint64_t work);
+
+/**
+ * Record that the transaction of thread self committed: its next transaction starts afresh
+ */
+void cm_commit(enum cm_policy_t policy, unsigned self);
@@ -0,0 +1,519 @@
+/**
+ * @file   dv.c
+ *
+ * @section DESCRIPTION
+ *
+ * Dual-versioned engine: every word has a readable and a writable copy, transactions run
+ * in batched epochs and the writes of committed transactions become readable at the end
+ * of their epoch. Read-only transactions only read readable copies and never abort.
+**/
+
+#include "dv.h"
+
+// ------- segments -------
+
+/**
+ * Allocate a zeroed segment and give it a segment id
+ * @return Segment id, 0 on failure
+ */
+static uint32_t dv_segment_create(struct dv_region_t *region, size_t size);
+
+/**
+ * Free a segment and release its id; only called while no transaction is running
+ */
+static void dv_segment_destroy(struct dv_region_t *region, uint32_t id);
+
+/**
+ * Translate an opaque address to its segment and word index
+ */
+static inline struct dv_segment_t *dv_translate(struct dv_region_t *region, void const *addr, size_t *word) {
+    uintptr_t a = (uintptr_t) addr;
+    *word = (a & (((uintptr_t) 1 << DV_SEGMENT_SHIFT) - 1)) >> region->align_shift;
+    return region->segments[a >> DV_SEGMENT_SHIFT];
+}
+
+// ------- batcher -------
+
+/**
+ * Enter an epoch, waiting for the next one if one is running. A read-write transaction is promised
+ * room for as many words and segment ids as its descriptor already holds, if memory allows.
+ */
+static void dv_batcher_enter(struct dv_region_t *region, struct dv_txn_t *txn);
+
+/**
+ * Leave the current epoch, handing the transaction's touched words and segments over to it.
+ * Never fails: the room they take was promised while the transaction ran (see dv_promise).
+ * The last transaction to leave ends the epoch.
+ * @param committed Whether the transaction committed (its frees apply) or aborted (its allocations are undone)
+ */
+static void dv_batcher_leave(struct dv_region_t *region, struct dv_txn_t *txn, bool committed);
+
+/**
+ * Swap the written words, reset every touched control word and free the segments of the epoch
+ */
+static void dv_epoch_end(struct dv_region_t *region);
+
+/**
+ * Grow the epoch arrays so that they can take touched more words and ids more segment ids, and
+ * promise that room to txn; batcher.lock must be held
+ * @return Whether the room could be allocated
+ */
+static bool dv_promise(struct dv_region_t *region, struct dv_txn_t *txn, size_t touched, size_t ids);
+
+/**
+ * Promise txn room for at least touched words and ids segment ids in total, doubling its share
+ * @return Whether the room could be allocated, the transaction must abort otherwise
+ */
+static bool dv_promise_more(struct dv_region_t *region, struct dv_txn_t *txn, size_t touched, size_t ids);
+
+// ------- transactions -------
+
+/**
+ * Grow *array so that it holds at least needed elements of elem_size bytes
+ */
+static bool dv_reserve(void **array, size_t *capacity, size_t needed, size_t elem_size);
+
+static bool dv_read_word(struct dv_region_t *region, struct dv_txn_t *txn, struct dv_segment_t *segment, size_t word, void *target);
+
+static bool dv_write_word(struct dv_region_t *region, struct dv_txn_t *txn, struct dv_segment_t *segment, size_t word, void const *source);
+
+/**
+ * Undo the transaction's writes, leave the epoch and release the descriptor
+ */
+static void dv_abort(struct dv_region_t *region, struct dv_txn_t *txn);
+
+static void dv_txn_release(struct dv_txn_t *txn);
+
+static void dv_txn_pool_destroy(struct desc_pool_node_t *node);
+
+static _Thread_local struct desc_pool_t dv_txn_pool = { .destroy = dv_txn_pool_destroy };
+
+// ============================================= engine functions =============================================
+
+static shared_t dv_create(size_t size, size_t align) {
+    struct dv_region_t *region = calloc(1, sizeof(struct dv_region_t));
+    if (unlikely(!region)) return invalid_shared;
+
+    region->segments = calloc(DV_MAX_SEGMENTS, sizeof(struct dv_segment_t *));
+    region->free_ids = malloc(DV_MAX_SEGMENTS * sizeof(uint32_t));
+    if (unlikely(!region->segments || !region->free_ids)) goto fail;
+
+    if (unlikely(pthread_mutex_init(&region->batcher.lock, NULL))) goto fail;
+    if (unlikely(pthread_cond_init(&region->batcher.cond, NULL))) goto fail_cond;
+    if (unlikely(pthread_mutex_init(&region->alloc_lock, NULL))) goto fail_alloc_lock;
+
+    region->engine = &dv_engine;
+    region->size = size;
+    region->align = align;
+    region->align_shift = __builtin_ctzl(align);
+    region->next_id = DV_BASE_SEGMENT;
+
+    // First segment, never freed
+    if (unlikely(dv_segment_create(region, size) != DV_BASE_SEGMENT)) goto fail_base;
+
+    LOG_LOG("dv_create: region %p of size %lu and alignment %lu was successfully created.\n", region, size, align);
+    return (shared_t) region;
+
+fail_base:
+    pthread_mutex_destroy(&region->alloc_lock);
+fail_alloc_lock:
+    pthread_cond_destroy(&region->batcher.cond);
+fail_cond:
+    pthread_mutex_destroy(&region->batcher.lock);
+fail:
+    free(region->free_ids);
+    free(region->segments);
+    free(region);
+    return invalid_shared;
+}
+
+static void dv_destroy(shared_t shared) {
+    struct dv_region_t *region = (struct dv_region_t *) shared;
+
+    for (uint32_t id = DV_BASE_SEGMENT; id < region->next_id; id++) {
+        free(region->segments[id]);
+    }
+    free(region->segments);
+    free(region->free_ids);
+    free(region->touched);
+    free(region->to_free);
+
+    pthread_mutex_destroy(&region->alloc_lock);
+    pthread_cond_destroy(&region->batcher.cond);
+    pthread_mutex_destroy(&region->batcher.lock);
+    free(region);
+}
+
+static void* dv_start(shared_t unused(shared)) {
+    return (void *) ((uintptr_t) DV_BASE_SEGMENT << DV_SEGMENT_SHIFT);
+}
+
+static size_t dv_size(shared_t shared) {
+    return ((struct dv_region_t *) shared)->size;
+}
+
+static size_t dv_align(shared_t shared) {
+    return ((struct dv_region_t *) shared)->align;
+}
+
+static tx_t dv_begin(shared_t shared, bool is_ro) {
+    struct dv_region_t *region = (struct dv_region_t *) shared;
+
+    struct dv_txn_t *txn = desc_pool_take(&dv_txn_pool);
+    if (unlikely(!txn)) {
+        // Register the pool so that it is freed on thread exit
+        desc_pool_register(&dv_txn_pool);
+        txn = calloc(1, sizeof(struct dv_txn_t));
+        if (unlikely(!txn)) {
+            LOG_TEST("dv_begin: memory allocation for transaction failed!\n");
+            return invalid_tx;
+        }
+    }
+
+    txn->is_ro = is_ro;
+    txn->touched_count = 0;
+    txn->alloc_count = 0;
+    txn->free_count = 0;
+    txn->touched_promised = 0;
+    txn->ids_promised = 0;
+
+    dv_batcher_enter(region, txn);
+    return (tx_t) txn;
+}
+
+static bool dv_end(shared_t shared, tx_t tx) {
+    struct dv_txn_t *txn = (struct dv_txn_t *) tx;
+
+    // Nothing can fail anymore: the writes become readable when the epoch ends
+    dv_batcher_leave((struct dv_region_t *) shared, txn, true);
+    dv_txn_release(txn);
+    return SUCCESS;
+}
+
+static bool dv_read(shared_t shared, tx_t tx, void const *source, size_t size, void *target) {
+    struct dv_region_t *region = (struct dv_region_t *) shared;
+    struct dv_txn_t *txn = (struct dv_txn_t *) tx;
+    size_t align = region->align;
+
+    size_t word;
+    struct dv_segment_t *segment = dv_translate(region, source, &word);
+    size_t words = size >> region->align_shift;
+
+    for (size_t i = 0; i < words; i++, word++) {
+        char *target_addr = (char *) target + i * align;
+
+        if (likely(txn->is_ro)) {
+            // The readable copy does not change during the epoch
+            uintptr_t state = atomic_load_explicit(&segment->controls[word], memory_order_relaxed);
+            memcpy(target_addr, segment->copies[state & DV_READABLE] + word * align, align);
+            continue;
+        }
+
+        if (unlikely(!dv_read_word(region, txn, segment, word, target_addr))) {
+            LOG_WARNING("dv_read: transaction %lu failed to read word %lu of segment %p!\n", tx, word, segment);
+            dv_abort(region, txn);
+            return ABORT;
+        }
+    }
+    return SUCCESS;
+}
+
+static bool dv_write(shared_t shared, tx_t tx, void const *source, size_t size, void *target) {
+    struct dv_region_t *region = (struct dv_region_t *) shared;
+    struct dv_txn_t *txn = (struct dv_txn_t *) tx;
+    size_t align = region->align;
+
+    size_t word;
+    struct dv_segment_t *segment = dv_translate(region, target, &word);
+    size_t words = size >> region->align_shift;
+
+    for (size_t i = 0; i < words; i++, word++) {
+        if (unlikely(!dv_write_word(region, txn, segment, word, (char const *) source + i * align))) {
+            LOG_WARNING("dv_write: transaction %lu failed to write word %lu of segment %p!\n", tx, word, segment);
+            dv_abort(region, txn);
+            return ABORT;
+        }
+    }
+    return SUCCESS;
+}
+
+static alloc_t dv_alloc(shared_t shared, tx_t tx, size_t size, void **target) {
+    struct dv_region_t *region = (struct dv_region_t *) shared;
+    struct dv_txn_t *txn = (struct dv_txn_t *) tx;
+
+    if (unlikely(!dv_reserve((void **) &txn->allocs, &txn->alloc_capacity, txn->alloc_count + 1, sizeof(uint32_t)) ||
+                 !dv_promise_more(region, txn, 0, txn->alloc_count + txn->free_count + 1)))
+        return nomem_alloc;
+
+    uint32_t id = dv_segment_create(region, size);
+    if (unlikely(!id)) {
+        LOG_WARNING("dv_alloc: transaction %lu allocation failed\n", tx);
+        return nomem_alloc;
+    }
+
+    // Undone at the end of the epoch if the transaction aborts
+    txn->allocs[txn->alloc_count++] = id;
+    *target = (void *) ((uintptr_t) id << DV_SEGMENT_SHIFT);
+    return success_alloc;
+}
+
+static bool dv_free(shared_t shared, tx_t tx, void *target) {
+    struct dv_region_t *region = (struct dv_region_t *) shared;
+    struct dv_txn_t *txn = (struct dv_txn_t *) tx;
+
+    if (unlikely(!dv_reserve((void **) &txn->frees, &txn->free_capacity, txn->free_count + 1, sizeof(uint32_t)) ||
+                 !dv_promise_more(region, txn, 0, txn->alloc_count + txn->free_count + 1))) {
+        dv_abort(region, txn);
+        return ABORT;
+    }
+
+    // Applied at the end of the epoch if the transaction commits
+    txn->frees[txn->free_count++] = (uint32_t) ((uintptr_t) target >> DV_SEGMENT_SHIFT);
+    return SUCCESS;
+}
+
+struct engine_t const dv_engine = {
+    .name    = "dv",
+    .create  = dv_create,
+    .destroy = dv_destroy,
+    .start   = dv_start,
+    .size    = dv_size,
+    .align   = dv_align,
+    .begin   = dv_begin,
+    .end     = dv_end,
+    .read    = dv_read,
+    .write   = dv_write,
+    .alloc   = dv_alloc,
+    .free    = dv_free,
+};
+
+// ============================================= static functions implementation =============================================
+static uint32_t dv_segment_create(struct dv_region_t *region, size_t size) {
+    size_t words = size >> region->align_shift;
+
+    // Layout: header, control words, then both copies (calloc: everything starts zeroed)
+    struct dv_segment_t *segment = calloc(1, sizeof(struct dv_segment_t) + words * sizeof(dv_control_t) + 2 * size);
+    if (unlikely(!segment)) return 0;
+    segment->size = size;
+    segment->controls = (dv_control_t *) (segment + 1);
+    segment->copies[0] = (char *) (segment->controls + words);
+    segment->copies[1] = segment->copies[0] + size;
+
+    pthread_mutex_lock(&region->alloc_lock);
+    uint32_t id = 0;
+    if (likely(region->free_id_count > 0)) {
+        id = region->free_ids[--region->free_id_count];
+    } else if (likely(region->next_id < DV_MAX_SEGMENTS)) {
+        id = region->next_id++;
+    }
+    if (likely(id)) region->segments[id] = segment;
+    pthread_mutex_unlock(&region->alloc_lock);
+
+    if (unlikely(!id)) {
+        LOG_WARNING("dv_segment_create: no segment id left in region %p\n", region);
+        free(segment);
+    }
+    return id;
+}
+
+static void dv_segment_destroy(struct dv_region_t *region, uint32_t id) {
+    pthread_mutex_lock(&region->alloc_lock);
+    // A segment may be freed by several transactions of the same epoch
+    if (likely(region->segments[id])) {
+        free(region->segments[id]);
+        region->segments[id] = NULL;
+        region->free_ids[region->free_id_count++] = id;
+    }
+    pthread_mutex_unlock(&region->alloc_lock);
+}
+
+static void dv_batcher_enter(struct dv_region_t *region, struct dv_txn_t *txn) {
+    struct dv_batcher_t *batcher = &region->batcher;
+
+    pthread_mutex_lock(&batcher->lock);
+    // Taken with the lock held anyway; without the memory, the transaction asks again when it needs it
+    if (!txn->is_ro) dv_promise(region, txn, txn->touched_capacity, txn->alloc_capacity + txn->free_capacity);
+    if (likely(batcher->remaining == 0)) {
+        batcher->remaining = 1;
+    } else {
+        // Wait for the next epoch
+        batcher->blocked++;
+        uint64_t epoch = batcher->epoch;
+        while (epoch == batcher->epoch) {
+            pthread_cond_wait(&batcher->cond, &batcher->lock);
+        }
+    }
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+static void dv_batcher_leave(struct dv_region_t *region, struct dv_txn_t *txn, bool committed) {
+    struct dv_batcher_t *batcher = &region->batcher;
+    uint32_t *ids = committed ? txn->frees : txn->allocs;
+    size_t id_count = committed ? txn->free_count : txn->alloc_count;
+
+    pthread_mutex_lock(&batcher->lock);
+
+    // Hand over the words and segments the end of the epoch has to process, into the room promised to them
+    if (likely(txn->touched_count > 0)) {
+        memcpy(region->touched + region->touched_count, txn->touched, txn->touched_count * sizeof(struct dv_ref_t));
+        region->touched_count += txn->touched_count;
+    }
+    if (unlikely(id_count > 0)) {
+        memcpy(region->to_free + region->to_free_count, ids, id_count * sizeof(uint32_t));
+        region->to_free_count += id_count;
+    }
+    region->touched_promised -= txn->touched_promised;
+    region->to_free_promised -= txn->ids_promised;
+
+    if (--batcher->remaining == 0) {
+        dv_epoch_end(region);
+        batcher->epoch++;
+        batcher->remaining = batcher->blocked;
+        batcher->blocked = 0;
+        pthread_cond_broadcast(&batcher->cond);
+    }
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+static void dv_epoch_end(struct dv_region_t *region) {
+    // No transaction is running: control words and segments can be updated freely
+    for (size_t i = 0; i < region->touched_count; i++) {
+        dv_control_t *control = &region->touched[i].segment->controls[region->touched[i].word];
+        uintptr_t state = atomic_load_explicit(control, memory_order_relaxed);
+
+        // Written words swap their copies, all of them forget who accessed them
+        uintptr_t readable = state & DV_READABLE;
+        if (state & DV_WRITTEN) readable ^= DV_READABLE;
+        atomic_store_explicit(control, readable, memory_order_relaxed);
+    }
+    region->touched_count = 0;
+
+    for (size_t i = 0; i < region->to_free_count; i++) {
+        dv_segment_destroy(region, region->to_free[i]);
+    }
+    region->to_free_count = 0;
+}
+
+static bool dv_promise(struct dv_region_t *region, struct dv_txn_t *txn, size_t touched, size_t ids) {
+    if (unlikely(!dv_reserve((void **) &region->touched, &region->touched_capacity,
+                             region->touched_count + region->touched_promised + touched, sizeof(struct dv_ref_t)) ||
+                 !dv_reserve((void **) &region->to_free, &region->to_free_capacity,
+                             region->to_free_count + region->to_free_promised + ids, sizeof(uint32_t))))
+        return false;
+
+    region->touched_promised += touched;
+    region->to_free_promised += ids;
+    txn->touched_promised += touched;
+    txn->ids_promised += ids;
+    return true;
+}
+
+static bool dv_promise_more(struct dv_region_t *region, struct dv_txn_t *txn, size_t touched, size_t ids) {
+    if (likely(touched <= txn->touched_promised && ids <= txn->ids_promised)) return true;
+
+    size_t more_touched = 0, more_ids = 0;
+    if (touched > txn->touched_promised) more_touched = txn->touched_promised > INITIAL_CAPACITY ? txn->touched_promised : INITIAL_CAPACITY;
+    if (ids > txn->ids_promised) more_ids = txn->ids_promised > INITIAL_CAPACITY ? txn->ids_promised : INITIAL_CAPACITY;
+
+    pthread_mutex_lock(&region->batcher.lock);
+    bool promised = dv_promise(region, txn, more_touched, more_ids);
+    pthread_mutex_unlock(&region->batcher.lock);
+    return promised;
+}
+
+static bool dv_reserve(void **array, size_t *capacity, size_t needed, size_t elem_size) {
+    if (likely(needed <= *capacity)) return true;
+
+    size_t new_capacity = *capacity ? *capacity : INITIAL_CAPACITY;
+    while (new_capacity < needed) new_capacity *= GROW_FACTOR;
+    void *new_array = realloc(*array, new_capacity * elem_size);
+    if (unlikely(!new_array)) return false;
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+static bool dv_read_word(struct dv_region_t *region, struct dv_txn_t *txn, struct dv_segment_t *segment, size_t word, void *target) {
+    dv_control_t *control = &segment->controls[word];
+    uintptr_t me = (uintptr_t) txn;
+    uintptr_t state = atomic_load(control);
+
+    while (true) {
+        uintptr_t owner = state & DV_ACCESS_MASK;
+        if (unlikely(state & DV_WRITTEN)) {
+            // Written in this epoch: only the writer may read it, from the writable copy
+            if (owner != me) return ABORT;
+            memcpy(target, segment->copies[(state & DV_READABLE) ^ DV_READABLE] + word * region->align, region->align);
+            return SUCCESS;
+        }
+        if (owner == me || owner == DV_ACCESS_MANY) break;
+
+        // Add the transaction to the access set; record the word before changing its control word
+        if (unlikely(!dv_reserve((void **) &txn->touched, &txn->touched_capacity, txn->touched_count + 1, sizeof(struct dv_ref_t)) ||
+                     !dv_promise_more(region, txn, txn->touched_count + 1, 0)))
+            return ABORT;
+        uintptr_t claimed = (state & ~DV_ACCESS_MASK) | (owner ? DV_ACCESS_MANY : me);
+        if (atomic_compare_exchange_weak(control, &state, claimed)) {
+            txn->touched[txn->touched_count++] = (struct dv_ref_t) { segment, word };
+            break;
+        }
+    }
+
+    memcpy(target, segment->copies[state & DV_READABLE] + word * region->align, region->align);
+    return SUCCESS;
+}
+
+static bool dv_write_word(struct dv_region_t *region, struct dv_txn_t *txn, struct dv_segment_t *segment, size_t word, void const *source) {
+    dv_control_t *control = &segment->controls[word];
+    uintptr_t me = (uintptr_t) txn;
+    uintptr_t state = atomic_load(control);
+
+    while (true) {
+        uintptr_t owner = state & DV_ACCESS_MASK;
+        if (unlikely(state & DV_WRITTEN)) {
+            // Written in this epoch: only its writer may write it again
+            if (owner != me) return ABORT;
+            break;
+        }
+        // Accessed by another transaction in this epoch
+        if (owner != 0 && owner != me) return ABORT;
+
+        if (unlikely(!dv_reserve((void **) &txn->touched, &txn->touched_capacity, txn->touched_count + 1, sizeof(struct dv_ref_t)) ||
+                     !dv_promise_more(region, txn, txn->touched_count + 1, 0)))
+            return ABORT;
+        if (atomic_compare_exchange_weak(control, &state, (state & DV_READABLE) | DV_WRITTEN | me)) {
+            if (owner == 0) txn->touched[txn->touched_count++] = (struct dv_ref_t) { segment, word };
+            break;
+        }
+    }
+
+    memcpy(segment->copies[(state & DV_READABLE) ^ DV_READABLE] + word * region->align, source, region->align);
+    return SUCCESS;
+}
+
+static void dv_abort(struct dv_region_t *region, struct dv_txn_t *txn) {
+    uintptr_t me = (uintptr_t) txn;
+
+    // Withdraw from the words the transaction still owns alone, so others can use them in this epoch
+    for (size_t i = 0; i < txn->touched_count; i++) {
+        dv_control_t *control = &txn->touched[i].segment->controls[txn->touched[i].word];
+        uintptr_t state = atomic_load(control);
+        while ((state & DV_ACCESS_MASK) == me &&
+               !atomic_compare_exchange_weak(control, &state, state & DV_READABLE));
+    }
+
+    dv_batcher_leave(region, txn, false);
+    dv_txn_release(txn);
+}
+
+static void dv_txn_release(struct dv_txn_t *txn) {
+    desc_pool_put(&dv_txn_pool, txn);
+}
+
+static void dv_txn_pool_destroy(struct desc_pool_node_t *node) {
+    struct dv_txn_t *txn = (struct dv_txn_t *) node;
+    free(txn->touched);
+    free(txn->allocs);
+    free(txn->frees);
+    free(txn);
+}
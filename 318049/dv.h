@@ -0,0 +1,113 @@
+#pragma once
+
+// Requested feature: pthread condition variables
+#define _POSIX_C_SOURCE   200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "helper.h"
+#include "pool.h"
+#include "tm.h"
+#include "macros.h"
+
+/**
+ * @brief Control word of a shared word (see the DV_* masks in helper.h).
+ * Holds the index of the readable copy, whether the word was written in the current epoch
+ * and which transaction(s) accessed it in the current epoch.
+ */
+typedef atomic_uintptr_t dv_control_t;
+
+/**
+ * @brief Segment of dual-versioned shared memory.
+ * Every word has two copies: the readable one, seen by read-only transactions and by
+ * read-write transactions until they write it, and the writable one, swapped in at the
+ * end of the epoch in which it was written.
+ * @param size     size of the segment in bytes
+ * @param controls one control word per word
+ * @param copies   the two copies of the segment
+ */
+struct dv_segment_t {
+    size_t size;
+    dv_control_t *controls;
+    char *copies[2];
+};
+
+/**
+ * @brief Reference to a word whose control word must be reset at the end of the epoch.
+ */
+struct dv_ref_t {
+    struct dv_segment_t *segment;
+    size_t word;
+};
+
+/**
+ * @brief Epoch batcher.
+ * Transactions that begin while an epoch is running wait for the next one; the last
+ * transaction to leave an epoch commits it.
+ */
+struct dv_batcher_t {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t epoch;
+    size_t remaining;       // Transactions running in the current epoch
+    size_t blocked;         // Transactions waiting for the next epoch
+};
+
+// ============ Shared region ============
+/**
+ * @brief Dual-versioned shared memory region.
+ * Addresses handed out are opaque: (segment id << DV_SEGMENT_SHIFT) | offset.
+ */
+struct dv_region_t {
+    struct engine_t const *engine;          // Must come first, see engine_of
+    size_t size;
+    size_t align;
+    unsigned int align_shift;               // log2(align)
+
+    struct dv_batcher_t batcher;
+
+    pthread_mutex_t alloc_lock;             // Lock to seize when allocating a segment id
+    struct dv_segment_t **segments;         // Indexed by segment id
+    uint32_t *free_ids;                     // Segment ids available for reuse
+    size_t free_id_count;
+    uint32_t next_id;                       // Lowest segment id never used
+
+    // Epoch state, only accessed with batcher.lock held
+    struct dv_ref_t *touched;               // Words accessed in the current epoch
+    size_t touched_count;
+    size_t touched_capacity;
+    size_t touched_promised;                // Room kept for the running transactions: capacity >= count + promised
+    uint32_t *to_free;                      // Segments to free at the end of the current epoch
+    size_t to_free_count;
+    size_t to_free_capacity;
+    size_t to_free_promised;
+};
+
+// ============ Transaction ============
+struct dv_txn_t {
+    struct desc_pool_node_t pool_node;  // Link in the thread's descriptor pool, while this one is unused
+    bool is_ro;
+
+    // Words whose control word this transaction changed
+    struct dv_ref_t *touched;
+    size_t touched_count;
+    size_t touched_capacity;
+
+    // Segments allocated / freed by this transaction
+    uint32_t *allocs;
+    size_t alloc_count;
+    size_t alloc_capacity;
+    uint32_t *frees;
+    size_t free_count;
+    size_t free_capacity;
+
+    // Room kept for this transaction in the epoch arrays, so that leaving the epoch cannot fail
+    size_t touched_promised;
+    size_t ids_promised;
+};
@@ -0,0 +1,379 @@
+/**
+ * @file   eager.c
+ *
+ * @section DESCRIPTION
+ *
+ * Eager TL2 engine: same versioned locks and global clock as TL2 (shared.c), but stripes are
+ * locked when first written and memory is updated in place, with an undo log for aborts.
+ * Conflicts between writers are detected at write time instead of at commit.
+**/
+
+#include "eager.h"
+
+// ------- transactions -------
+
+/**
+ * Check that no stripe read changed since txn->rv; stripes the transaction locked itself are
+ * checked against the version they had when it locked them
+ */
+static bool eager_validate(struct region_t *region, struct eager_txn_t *txn);
+
+/**
+ * Try extending the snapshot to the current global clock (see txn_extend)
+ */
+static bool eager_extend(struct region_t *region, struct eager_txn_t *txn, version_t version);
+
+/**
+ * Lock the stripe of a word about to be written, unless the transaction already owns it
+ */
+static bool eager_lock(struct region_t *region, struct eager_txn_t *txn, stripe_t stripe);
+
+/**
+ * Append the current value of the word at target to the undo log, unless the transaction already wrote it
+ */
+static bool eager_log_undo(struct eager_txn_t *txn, void *target);
+
+/**
+ * Release the locks of the transaction with the given version
+ */
+static void eager_unlock(struct region_t *region, struct eager_txn_t *txn, version_t version);
+
+/**
+ * Roll back the writes and allocations, release the locks and the descriptor
+ */
+static void eager_abort(struct region_t *region, struct eager_txn_t *txn);
+
+/**
+ * Leave the epoch and return the descriptor to the pool
+ */
+static void eager_release(struct eager_txn_t *txn);
+
+static struct eager_txn_t *eager_txn_alloc(size_t word_size);
+
+static void eager_txn_free(struct eager_txn_t *txn);
+
+static void eager_txn_pool_destroy(struct desc_pool_node_t *node);
+
+static _Thread_local struct desc_pool_t eager_txn_pool = { .destroy = eager_txn_pool_destroy };
+
+// ============================================= engine functions =============================================
+
+static shared_t eager_create(size_t size, size_t align) {
+    struct region_t *region = region_create(size, align);
+    if (unlikely(!region)) {
+        LOG_WARNING("eager_create: shared memory region creation failed.\n");
+        return invalid_shared;
+    }
+    region->engine = &tl2_eager_engine;
+    return (shared_t) region;
+}
+
+static void eager_destroy(shared_t shared) {
+    region_destroy((struct region_t *) shared);
+}
+
+static void* eager_start(shared_t shared) {
+    return region_start((struct region_t *) shared);
+}
+
+static size_t eager_size(shared_t shared) {
+    return region_size((struct region_t *) shared);
+}
+
+static size_t eager_align(shared_t shared) {
+    return region_align((struct region_t *) shared);
+}
+
+static tx_t eager_begin(shared_t shared, bool is_ro) {
+    struct region_t *region = (struct region_t *) shared;
+    // Keeps the segments this transaction may access from being reclaimed
+    if (unlikely(!ebr_enter())) {
+        LOG_TEST("eager_begin: epoch registration failed!\n");
+        return invalid_tx;
+    }
+
+    struct eager_txn_t *txn = desc_pool_take(&eager_txn_pool);
+    if (unlikely(!txn)) {
+        txn = eager_txn_alloc(region->align);
+        if (unlikely(!txn)) {
+            LOG_TEST("eager_begin: memory allocation for transaction failed!\n");
+            ebr_leave();
+            return invalid_tx;
+        }
+    }
+
+    r_log_reset(txn->reads);
+    r_log_reset(txn->locks);
+    r_log_reset(txn->written);
+    txn->is_ro = is_ro;
+    txn->owner = ebr_thread_id();
+    txn->work = 0;
+    cm_begin(region->cm_policy, txn->owner);
+    txn->rv = global_clock_load(&region->version_clock);
+    txn->entry_size = sizeof(void *) + region->align;
+    txn->undo_count = 0;
+    txn->frees.count = 0;
+    txn->allocs.count = 0;
+    return (tx_t) txn;
+}
+
+static bool eager_end(shared_t shared, tx_t tx) {
+    struct region_t *region = (struct region_t *) shared;
+    struct eager_txn_t *txn = (struct eager_txn_t *) tx;
+
+    // Transactions without writes are consistent at their snapshot
+    if (unlikely(txn->locks->count > 0)) {
+        bool exclusive;
+        version_t wv = region_update_version_clock(region, &exclusive);
+        if (unlikely((txn->rv + 1 != wv || !exclusive) && !eager_validate(region, txn))) {
+            LOG_WARNING("eager_end: transaction %lu failed to validate its reads!\n", tx);
+            eager_abort(region, txn);
+            return ABORT;
+        }
+        // Memory already holds the new values: publishing them is releasing the locks
+        eager_unlock(region, txn, wv);
+    }
+
+    // Committed: the allocations stay and the frees apply
+    cm_commit(region->cm_policy, txn->owner);
+    bool should_free_region = region_commit_logs(region, &txn->allocs, &txn->frees);
+
+    eager_release(txn);
+
+    if (unlikely(should_free_region)) region_schedule_free(region);
+    return SUCCESS;
+}
+
+static bool eager_read(shared_t shared, tx_t tx, void const *source, size_t size, void *target) {
+    struct region_t *region = (struct region_t *) shared;
+    struct eager_txn_t *txn = (struct eager_txn_t *) tx;
+    size_t word_size = region->align;
+    txn->work += size >> region->align_shift;
+
+    for (size_t i = 0; i < size; i += word_size) {
+        void const *source_addr = (char const *) source + i;
+        void *target_addr = (char *) target + i;
+        stripe_t stripe = region_get_stripe(region, source_addr);
+        v_lock_t *lock = region_get_memory_lock_from_index(region, stripe);
+
+        // Read-after-write: the transaction holds the lock, memory already holds its value
+        if (unlikely(v_lock_owner(lock) == txn->owner)) {
+            memcpy(target_addr, source_addr, word_size);
+            continue;
+        }
+
+        version_t lv_pre = v_lock_version(lock);
+        if (unlikely(lv_pre == LOCKED)) {
+            // Wait a little for the holder, then ask the contention manager
+            unsigned spins = region->lock_spins;
+            if (v_lock_wait(lock, &spins) || cm_wait(region->cm_policy, txn->owner, txn->work, lock)) lv_pre = v_lock_version(lock);
+        }
+        if (unlikely(lv_pre != LOCKED && lv_pre > txn->rv) && !txn->is_ro && eager_extend(region, txn, lv_pre)) {
+            // Lazy clock schemes may give the next commit of the stripe the same version: check it after the extension
+            lv_pre = v_lock_version(lock);
+        }
+        if ((lv_pre == LOCKED) || lv_pre > txn->rv) {
+            LOG_WARNING("eager_read: transaction %lu failed lock PRE-validation for source: %p!\n", tx, source_addr);
+            if (lv_pre != LOCKED) region_observe_version(region, lv_pre);
+            else cm_conflict(region->cm_policy, txn->owner, lock, stripe);
+            eager_abort(region, txn);
+            return ABORT;
+        }
+
+        memcpy(target_addr, source_addr, word_size);
+
+        if (unlikely(v_lock_version(lock) != lv_pre)) {
+            LOG_WARNING("eager_read: transaction %lu failed lock POST-validation for source: %p!\n", tx, source_addr);
+            eager_abort(region, txn);
+            return ABORT;
+        }
+
+        if (unlikely(!txn->is_ro && !r_log_add(txn->reads, stripe))) {
+            LOG_WARNING("eager_read: transaction %lu failed add source: %p to read-log!\n", tx, source_addr);
+            eager_abort(region, txn);
+            return ABORT;
+        }
+    }
+    return SUCCESS;
+}
+
+static bool eager_write(shared_t shared, tx_t tx, void const *source, size_t size, void *target) {
+    struct region_t *region = (struct region_t *) shared;
+    struct eager_txn_t *txn = (struct eager_txn_t *) tx;
+    size_t word_size = region->align;
+    txn->work += size >> region->align_shift;
+
+    for (size_t i = 0; i < size; i += word_size) {
+        void *target_addr = (char *) target + i;
+
+        if (unlikely(!eager_lock(region, txn, region_get_stripe(region, target_addr)))) {
+            LOG_WARNING("eager_write: transaction %lu failed to lock target: %p!\n", tx, target_addr);
+            eager_abort(region, txn);
+            return ABORT;
+        }
+        if (unlikely(!eager_log_undo(txn, target_addr))) {
+            LOG_WARNING("eager_write: transaction %lu failed to log target: %p!\n", tx, target_addr);
+            eager_abort(region, txn);
+            return ABORT;
+        }
+        memcpy(target_addr, (char const *) source + i, word_size);
+    }
+    return SUCCESS;
+}
+
+static alloc_t eager_alloc(shared_t shared, tx_t tx, size_t size, void **target) {
+    struct segment_node_t *node = region_alloc_logged((struct region_t *) shared, &((struct eager_txn_t *) tx)->allocs, size);
+    if (unlikely(!node)) {
+        LOG_WARNING("eager_alloc: transaction %lu allocation failed\n", tx);
+        return nomem_alloc;
+    }
+
+    void *data = (void *) ((uintptr_t) node + sizeof(struct segment_node_t));
+    *target = data;
+    return success_alloc;
+}
+
+static bool eager_free(shared_t unused(shared), tx_t tx, void *target) {
+    return free_log_add(&((struct eager_txn_t *) tx)->frees, target) ? SUCCESS : ABORT;
+}
+
+struct engine_t const tl2_eager_engine = {
+    .name    = "tl2-eager",
+    .create  = eager_create,
+    .destroy = eager_destroy,
+    .start   = eager_start,
+    .size    = eager_size,
+    .align   = eager_align,
+    .begin   = eager_begin,
+    .end     = eager_end,
+    .read    = eager_read,
+    .write   = eager_write,
+    .alloc   = eager_alloc,
+    .free    = eager_free,
+};
+
+// ============================================= static functions implementation =============================================
+static bool eager_validate(struct region_t *region, struct eager_txn_t *txn) {
+    struct r_log_t *reads = txn->reads;
+
+    for (size_t i = 0; i < reads->count; i++) {
+        v_lock_t *lock = region_get_memory_lock_from_index(region, reads->stripes[i]);
+
+        version_t lv = v_lock_version_for(lock, txn->owner);
+        if (unlikely(lv == LOCKED || lv > txn->rv)) return false;
+    }
+    return true;
+}
+
+static bool eager_extend(struct region_t *region, struct eager_txn_t *txn, version_t version) {
+    // Sample the clock before validating: every version up to it is then covered by the validation
+    region_observe_version(region, version);
+    version_t rv = global_clock_load(&region->version_clock);
+    if (unlikely(!eager_validate(region, txn))) return false;
+
+    txn->rv = rv;
+    return true;
+}
+
+static bool eager_lock(struct region_t *region, struct eager_txn_t *txn, stripe_t stripe) {
+    v_lock_t *lock = region_get_memory_lock_from_index(region, stripe);
+    if (likely(v_lock_owner(lock) == txn->owner)) return true;
+
+    // Transactions meeting this lock compare their priority to this one
+    cm_publish(region->cm_policy, txn->owner, txn->work);
+    unsigned spins = region->lock_spins;
+    while (!v_lock_acquire(lock, txn->owner)) {
+        if (v_lock_wait(lock, &spins) || cm_wait(region->cm_policy, txn->owner, txn->work, lock)) continue;
+        cm_conflict(region->cm_policy, txn->owner, lock, stripe);
+        return false;
+    }
+
+    // A stripe changed since the snapshot may have been read before: the snapshot must still hold
+    version_t version = v_lock_owned_version(lock);
+    if (unlikely(!r_log_add(txn->locks, stripe))) {
+        v_lock_release(lock);
+        return false;
+    }
+    return version <= txn->rv || eager_extend(region, txn, version);
+}
+
+static bool eager_log_undo(struct eager_txn_t *txn, void *target) {
+    // The first value logged for a word is the one from before the transaction: later ones are not needed
+    size_t written = txn->written->count;
+    if (unlikely(!r_log_add(txn->written, (stripe_t) (uintptr_t) target))) return false;
+    if (txn->written->count == written) return true;
+
+    if (unlikely((txn->undo_count + 1) * txn->entry_size > txn->undo_capacity)) {
+        size_t capacity = (txn->undo_capacity + txn->entry_size) * GROW_FACTOR;
+        char *undo = realloc(txn->undo, capacity);
+        if (unlikely(!undo)) return false;
+        txn->undo = undo;
+        txn->undo_capacity = capacity;
+    }
+
+    char *entry = txn->undo + txn->undo_count++ * txn->entry_size;
+    *(void **) entry = target;
+    memcpy(entry + sizeof(void *), target, txn->entry_size - sizeof(void *));
+    return true;
+}
+
+static void eager_unlock(struct region_t *region, struct eager_txn_t *txn, version_t version) {
+    struct r_log_t *locks = txn->locks;
+    for (size_t i = 0; i < locks->count; i++) {
+        v_lock_release_and_update(region_get_memory_lock_from_index(region, locks->stripes[i]), version);
+    }
+}
+
+static void eager_abort(struct region_t *region, struct eager_txn_t *txn) {
+    cm_abort(region->cm_policy, txn->owner, txn->work);
+    if (txn->locks->count > 0) {
+        // Each word is logged once, with its value from before the transaction
+        for (size_t i = txn->undo_count; i-- > 0;) {
+            char *entry = txn->undo + i * txn->entry_size;
+            memcpy(*(void **) entry, entry + sizeof(void *), txn->entry_size - sizeof(void *));
+        }
+        // Readers may have seen the rolled-back values between their lock checks: a fresh version makes them fail
+        eager_unlock(region, txn, region_update_version_clock(region, NULL));
+    }
+    if (unlikely(txn->allocs.count > 0)) region_rollback_allocs(region, &txn->allocs);
+    eager_release(txn);
+}
+
+static void eager_release(struct eager_txn_t *txn) {
+    ebr_leave();
+
+    desc_pool_put(&eager_txn_pool, txn);
+}
+
+static struct eager_txn_t *eager_txn_alloc(size_t word_size) {
+    // Register the pool so that it is freed on thread exit
+    desc_pool_register(&eager_txn_pool);
+
+    struct eager_txn_t *txn = calloc(1, sizeof(struct eager_txn_t));
+    if (unlikely(!txn)) return NULL;
+
+    txn->reads = r_log_init();
+    txn->locks = r_log_init();
+    txn->written = r_log_init();
+    txn->undo_capacity = EAGER_UNDO_LOG_INITIAL_CAPACITY * (sizeof(void *) + word_size);
+    txn->undo = malloc(txn->undo_capacity);
+    if (unlikely(!txn->reads || !txn->locks || !txn->written || !txn->undo)) {
+        eager_txn_free(txn);
+        return NULL;
+    }
+    return txn;
+}
+
+static void eager_txn_free(struct eager_txn_t *txn) {
+    if (txn->reads) r_log_free(txn->reads);
+    if (txn->locks) r_log_free(txn->locks);
+    if (txn->written) r_log_free(txn->written);
+    free(txn->undo);
+    free_log_free(&txn->frees);
+    alloc_log_free(&txn->allocs);
+    free(txn);
+}
+
+static void eager_txn_pool_destroy(struct desc_pool_node_t *node) {
+    eager_txn_free((struct eager_txn_t *) node);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "helper.h"
+#include "map.h"
+#include "pool.h"
+#include "shared.h"
+#include "v_lock.h"
+#include "tm.h"
+#include "macros.h"
+
+/**
+ * @brief Eager TL2 transaction (encounter-time locking, write-through).
+ * The stripe of a word is locked on the first write to it and the word is updated in place;
+ * its previous value is kept in the undo log to roll the transaction back. Reads of stripes the
+ * transaction owns are plain loads.
+ * @param rv            read version of the global clock
+ * @param reads         stripes read, validated at commit
+ * @param locks         stripes locked by the transaction
+ * @param written       addresses of the words in the undo log, each logged on its first write only
+ * @param undo          undo log: undo_count entries of entry_size bytes, each an address followed by the overwritten word
+ * @param undo_capacity size of undo in bytes (descriptors are reused across regions of different word sizes)
+ * @param frees         segments freed by the transaction, handed to the region once it committed
+ */
+struct eager_txn_t {
+    struct desc_pool_node_t pool_node;  // Link in the thread's descriptor pool, while this one is unused
+    bool is_ro;
+    version_t rv;
+    unsigned owner;     // Id of the thread running the transaction, owner of the locks it holds (see ebr_thread_id)
+    uint64_t work;      // Words accessed so far, the priority of some contention managers
+
+    struct r_log_t *reads;
+    struct r_log_t *locks;
+    struct r_log_t *written;
+
+    char *undo;
+    size_t entry_size;
+    size_t undo_count;
+    size_t undo_capacity;
+
+    struct free_log_t frees;
+    struct alloc_log_t allocs;      // Segments allocated by the transaction, rolled back if it aborts
+};
@@ -0,0 +1,137 @@
+/**
+ * @file   ebr.c
+ *
+ * @section DESCRIPTION
+ *
+ * Epoch-based reclamation: threads announce the global epoch when they start a transaction,
+ * segments freed by committed transactions are tagged with the epoch they were retired at and
+ * released once every thread has passed it (see region_free).
+**/
+
+#include "ebr.h"
+
+static atomic_ulong ebr_global_epoch = 1;
+static _Atomic(struct ebr_thread_t *) ebr_threads;     // Registry of all records
+static atomic_uint ebr_thread_count;                    // Records in the registry
+static _Atomic(ebr_register_hook_t) ebr_hook;
+
+static _Thread_local struct ebr_thread_t *ebr_self;
+static pthread_key_t ebr_key;
+static pthread_once_t ebr_once = PTHREAD_ONCE_INIT;
+
+static void ebr_key_create(void);
+
+/**
+ * pthread key destructor, releases the exiting thread's record
+ */
+static void ebr_thread_exit(void *record);
+
+/**
+ * Take a released record or add a new one to the registry
+ */
+static struct ebr_thread_t *ebr_register(void);
+
+// ============================================= global functions =============================================
+
+void ebr_set_register_hook(ebr_register_hook_t hook) {
+    ebr_register_hook_t expected = NULL;
+    atomic_compare_exchange_strong(&ebr_hook, &expected, hook);
+}
+
+bool ebr_enter(void) {
+    struct ebr_thread_t *self = ebr_self;
+    if (unlikely(!self)) {
+        self = ebr_register();
+        if (unlikely(!self)) return false;
+    }
+    if (self->depth++ > 0) return true;
+
+    // Announce an epoch that is still current once the announcement is visible
+    unsigned long epoch;
+    do {
+        epoch = atomic_load(&ebr_global_epoch);
+        atomic_store(&self->epoch, epoch);
+    } while (unlikely(atomic_load(&ebr_global_epoch) != epoch));
+    return true;
+}
+
+void ebr_leave(void) {
+    struct ebr_thread_t *self = ebr_self;
+    if (--self->depth == 0) {
+        atomic_store_explicit(&self->epoch, EBR_QUIESCENT, memory_order_release);
+    }
+}
+
+unsigned ebr_thread_id(void) {
+    return ebr_self->id;
+}
+
+unsigned long ebr_epoch(void) {
+    return atomic_load(&ebr_global_epoch);
+}
+
+unsigned long ebr_try_advance(void) {
+    unsigned long epoch = atomic_load(&ebr_global_epoch);
+    for (struct ebr_thread_t *record = atomic_load(&ebr_threads); record; record = record->next) {
+        unsigned long announced = atomic_load(&record->epoch);
+        if (announced != EBR_QUIESCENT && announced != epoch) return epoch;
+    }
+    atomic_compare_exchange_strong(&ebr_global_epoch, &epoch, epoch + 1);
+    return atomic_load(&ebr_global_epoch);
+}
+
+// ============================================= static functions implementation =============================================
+static void ebr_key_create(void) {
+    pthread_key_create(&ebr_key, ebr_thread_exit);
+}
+
+static void ebr_thread_exit(void *record) {
+    struct ebr_thread_t *self = (struct ebr_thread_t *) record;
+    self->depth = 0;
+    atomic_store(&self->epoch, EBR_QUIESCENT);
+    atomic_store(&self->in_use, false);
+}
+
+static struct ebr_thread_t *ebr_register(void) {
+    pthread_once(&ebr_once, ebr_key_create);
+
+    struct ebr_thread_t *self = NULL;
+    for (struct ebr_thread_t *record = atomic_load(&ebr_threads); record; record = record->next) {
+        bool expected = false;
+        if (!atomic_load_explicit(&record->in_use, memory_order_relaxed) &&
+            atomic_compare_exchange_strong(&record->in_use, &expected, true)) {
+            self = record;
+            break;
+        }
+    }
+
+    if (!self) {
+        // Only take an id below the limit: a refused thread must not use up the ids of later ones
+        unsigned id = atomic_load(&ebr_thread_count);
+        do {
+            if (unlikely(id >= EBR_MAX_THREADS)) {
+                LOG_WARNING("ebr_register: more than %d threads at once\n", EBR_MAX_THREADS);
+                return NULL;
+            }
+        } while (!atomic_compare_exchange_weak(&ebr_thread_count, &id, id + 1));
+        id++;
+        self = aligned_alloc(EBR_CACHE_LINE, sizeof(struct ebr_thread_t));
+        if (unlikely(!self)) return NULL;
+        atomic_init(&self->epoch, EBR_QUIESCENT);
+        atomic_init(&self->in_use, true);
+        self->depth = 0;
+        self->id = id;
+
+        struct ebr_thread_t *head = atomic_load(&ebr_threads);
+        do {
+            self->next = head;
+        } while (!atomic_compare_exchange_weak(&ebr_threads, &head, self));
+    }
+
+    // Fresh or reused, the id starts without the state of a previous holder
+    ebr_register_hook_t hook = atomic_load(&ebr_hook);
+    if (hook) hook(self->id);
+    pthread_setspecific(ebr_key, self);
+    ebr_self = self;
+    return self;
+}
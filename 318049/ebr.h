@@ -0,0 +1,70 @@
+#pragma once
+
+// Requested feature: pthread keys
+#define _POSIX_C_SOURCE   200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "helper.h"
+#include "macros.h"
+
+/**
+ * @brief Epoch announcement of a thread (epoch-based reclamation).
+ * Records are process-wide, so a thread announces once whatever region its transactions use.
+ * They are never freed: a record released by an exiting thread is reused by the next new thread.
+ * @param epoch  global epoch seen when the thread entered its outermost transaction, EBR_QUIESCENT outside
+ * @param in_use whether a thread owns the record
+ * @param depth  number of transactions the owner thread is running (on different regions)
+ * @param id     number of the record, from 1: identifies its thread, e.g. as the owner of a lock
+ */
+struct ebr_thread_t {
+    _Alignas(EBR_CACHE_LINE) atomic_ulong epoch;
+    atomic_bool in_use;
+    size_t depth;
+    unsigned id;
+    struct ebr_thread_t *next;
+};
+
+/**
+ * Hook called with the id of a record handed to a thread (new or released by an exiting one), before
+ * the thread uses it, so that per-id state kept by other modules starts afresh
+ */
+typedef void (*ebr_register_hook_t)(unsigned id);
+
+/**
+ * Set the register hook; there is one, set once and for all (later calls are ignored)
+ */
+void ebr_set_register_hook(ebr_register_hook_t hook);
+
+/**
+ * Announce that the calling thread starts a transaction: memory retired from now on is not
+ * reclaimed before the thread leaves. Only touches the thread's own record.
+ * @return Whether the thread could be registered
+ */
+bool ebr_enter(void);
+
+/**
+ * Announce that the calling thread ended a transaction
+ */
+void ebr_leave(void);
+
+/**
+ * @return Id of the calling thread's record (1 to EBR_MAX_THREADS), unique among the running threads;
+ * only valid between ebr_enter and ebr_leave
+ */
+unsigned ebr_thread_id(void);
+
+/**
+ * @return Current global epoch, to tag memory retired now
+ */
+unsigned long ebr_epoch(void);
+
+/**
+ * Move the global epoch forward if every thread inside a transaction announced the current one.
+ * Memory retired at epoch e is unreachable by any transaction once the global epoch is e + 2.
+ * @return Global epoch after the attempt
+ */
+unsigned long ebr_try_advance(void);
@@ -0,0 +1,27 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+static struct engine_t const *const engines[] = {
+    &tl2_engine,
+    &tl2_mv_engine,
+    &tl2_eager_engine,
+    &norec_engine,
+    &dv_engine,
+};
+
+struct engine_t const *engine_select(void) {
+    char const *name = getenv(ENGINE_ENV);
+    if (likely(!name)) name = DEFAULT_ENGINE;
+
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i]->name, name) == 0) return engines[i];
+    }
+
+    LOG_WARNING("engine_select: unknown engine '%s', using '%s'\n", name, DEFAULT_ENGINE);
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i]->name, DEFAULT_ENGINE) == 0) return engines[i];
+    }
+    return &tl2_engine;
+}
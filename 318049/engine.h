@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "helper.h"
+#include "tm.h"
+#include "macros.h"
+
+/**
+ * @brief Transaction engine: one implementation of the tm.h interface.
+ * Every region handle (shared_t) created by an engine starts with a pointer to that engine,
+ * so that tm.c can dispatch each call to the engine the region was created with.
+ */
+struct engine_t {
+    char const *name;
+
+    shared_t (*create)(size_t size, size_t align);
+    void     (*destroy)(shared_t shared);
+    void*    (*start)(shared_t shared);
+    size_t   (*size)(shared_t shared);
+    size_t   (*align)(shared_t shared);
+    tx_t     (*begin)(shared_t shared, bool is_ro);
+    bool     (*end)(shared_t shared, tx_t tx);
+    bool     (*read)(shared_t shared, tx_t tx, void const *source, size_t size, void *target);
+    bool     (*write)(shared_t shared, tx_t tx, void const *source, size_t size, void *target);
+    alloc_t  (*alloc)(shared_t shared, tx_t tx, size_t size, void **target);
+    bool     (*free)(shared_t shared, tx_t tx, void *target);
+};
+
+// Available engines
+extern struct engine_t const tl2_engine;   // Single-version TL2 (txn.c, shared.c)
+extern struct engine_t const tl2_mv_engine; // TL2 keeping bounded per-stripe histories for read-only transactions (mv.c)
+extern struct engine_t const tl2_eager_engine; // TL2 with encounter-time locking and in-place writes (eager.c, shared.c)
+extern struct engine_t const norec_engine;  // Global sequence lock and value-based validation (norec.c, shared.c)
+extern struct engine_t const dv_engine;    // Dual-versioned STM with epoch batching (dv.c)
+
+/**
+ * Select the engine of a new region: the one named by the TM_ENGINE environment variable,
+ * DEFAULT_ENGINE if it is unset or unknown.
+ * @return Engine to create the region with
+ */
+struct engine_t const *engine_select(void);
+
+/**
+ * @return Engine the region was created with
+ */
+static inline struct engine_t const *engine_of(shared_t shared) {
+    return *(struct engine_t const **) shared;
+}
@@ -5,21 +5,84 @@
 #include <time.h>
 #include <stdatomic.h>
 #include <stdint.h>
+#include <limits.h>
 
 #include "macros.h"
 
-typedef atomic_int version_clock_t; // The type of the version clock
+typedef int64_t version_t;          // A version of the version clock or of a lock (64 bits: never wraps around)
+typedef _Atomic version_t version_clock_t; // The type of the version clock
+typedef uint64_t stripe_t;          // Identifies the versioned lock covering a word, see region_get_stripe
+
+// engine.h
+#define ENGINE_ENV "TM_ENGINE"          // Environment variable naming the engine of new regions
+#define DEFAULT_ENGINE "tl2"
 
 // map.h
 #define INITIAL_CAPACITY 16
 #define GROW_FACTOR 2
 #define MAX_LOAD_FACTOR 0.70
+#define W_SET_MAX_CACHED_CAPACITY 256   // Pooled write sets larger than this are shrunk back on reuse
+
+#define LOCK_SET_SORT_THRESHOLD 16      // Lock sets up to this size are insertion sorted, larger ones use qsort
 
 // shared.h
-#define VLOCK_NUM 8192
+#define VLOCK_NUM 65536                         // Locks of the hashed table shared by the segments without a lock table
+#define LOCK_TABLES 32                          // Lock tables per region: 0 stands for the hashed table, BASE_LOCK_TABLE is the base segment's
+#define BASE_LOCK_TABLE 1
+#define LOCK_TABLE_INDEX_BITS 27                // A stripe is its lock table in the high bits and its lock in that table in the low ones
+#define LOCK_TABLE_ALIGN 64                     // Lock tables start on a cache line
+#define WORDS_PER_LOCK_ENV "TM_WORDS_PER_LOCK"  // Words covered by each lock of a lock table (rounded up to a power of two)
+#define DEFAULT_WORDS_PER_LOCK 8
+#define STRIPE_GRANULARITY_ENV "TM_STRIPE_GRANULARITY" // Bytes covered by a stripe: "word" (default), "line", "page" or a power of two
+#define STRIPE_PADDING_ENV "TM_STRIPE_PADDING"  // Set (and not "0") to give every lock its own cache line
+#define STRIPE_PAD_SHIFT 3                      // Padded stripes use one lock out of 8 (a 64-byte line of locks)
+#define SEGMENT_IDS_ENV "TM_SEGMENT_IDS"        // Set (and not "0") to hand out segment-tagged addresses (TL2 engines)
+#define SEGMENT_ID_SHIFT 48                     // Tagged address: segment id in the high 16 bits, offset in the segment in the low 48
+#define SEGMENT_IDS 65536
+#define SEGMENT_BASE_ID 1                       // Id 0 stands for plain (untagged) addresses
+#define COLOCATED_ENV "TM_COLOCATED"            // Set (and not "0") to store each word next to its own lock (tl2 engine)
 #define INITIAL_TO_FREE_CAPACITY 64
 #define SEGMENT_FREE_BATCH_SIZE 128
 #define SEGMENT_FREE_BATCH_CUM_SIZE 1048576     // 1MB
+#define RECYCLED_SEGMENTS_MAX 16                // Segments of aborted transactions, or freed mapped ones, kept per region for reuse
+#define REGION_POOL_SIZE 4                      // Destroyed regions kept process-wide for reuse by region_create
+#define MMAP_THRESHOLD 262144                   // 256KB, base segments and segments from this size are anonymous mappings
+#define HUGE_PAGES_ENV "TM_HUGE_PAGES"          // Set (and not "0") to back the mappings of new regions with 2MB pages
+#define HUGE_PAGE_SIZE 2097152                  // 2MB, segments from this size use huge pages in such regions
+#define RECLAIMER_ENV "TM_RECLAIMER"            // Set (and not "0") to free segments from a background thread per region
+#define RECLAIMER_RETRY_NS 1000000              // 1ms, period of the reclaimer while retired batches wait for the epoch
+
+#define MV_SNAPSHOT_SLOTS 64          // Read-only snapshots registered for history garbage collection
+#define MV_NO_SNAPSHOT INT64_MAX
+
+// ebr.h
+#define EBR_QUIESCENT 0UL               // Announcement of a thread outside any transaction (epochs start at 1)
+#define EBR_CACHE_LINE 64               // Thread announcements are padded to a cache line
+#define EBR_MAX_THREADS ((1 << LOCK_OWNER_BITS) - 1)    // Thread records, so that their ids (from 1) fit in a lock owner field
+
+// cm.h
+#define CM_ENV "TM_CM"                  // Contention manager of new regions: "none" (default), "backoff", "serialize", "karma", "greedy" or "long"
+#define CM_CACHE_LINE 64                // Thread records are padded to a cache line
+#define CM_WAIT_SPINS 1024              // Pauses a transaction with the priority waits for a held lock
+#define CM_BACKOFF_MIN_SPINS 16         // Bound of the random backoff after the first abort, in pauses
+#define CM_BACKOFF_MAX_SHIFT 10         // The bound doubles with each consecutive abort, up to 2^10 times the first one
+#define CM_SERIALIZE_REPEATS 2          // Conflicts in a row with the same thread or stripe before queuing behind the thread
+#define CM_QUEUE_YIELDS 256             // Yields a queued thread waits for the transaction it is queued behind
+#define CM_NO_STRIPE UINT64_MAX         // Stripe of the last conflict of a thread that had none yet
+
+// slab.h
+#define SLAB_MIN_CHUNK_SHIFT 6          // Smallest chunk (segment header included): 64 bytes
+#define SLAB_CLASSES 9                  // Chunks of 64 bytes to 16KB, by powers of two
+#define SLAB_NO_CLASS (-1)              // Segment too large (or too aligned) for the slabs
+#define SLAB_MAX_ALIGN 32               // Chunks are 64-byte aligned, segment data follows a 32-byte header
+#define SLAB_BLOCK_SIZE 262144          // 256KB carved into chunks of one class
+#define SLAB_CACHE_MAX 64               // Chunks per class in a thread cache before half of them go to the depot
+#define SLAB_REFILL 32                  // Chunks moved from the depot to a thread cache at once
+#define SLAB_THREAD_CACHES 4            // Regions a thread caches chunks for at the same time
+#define SLAB_LIVE_BUCKETS 256           // Buckets of the registry of live slabs, by id
+
+// mv.h
+#define MV_HISTORY_DEPTH 8              // Overwritten words kept per stripe in multi-version mode
 
 // txn.h
 #define ABORT false
@@ -28,6 +91,29 @@ typedef atomic_int version_clock_t; // The type of the version clock
 
 // v_lock.h
 #define LOCKED (-1)
+#define LOCK_OWNER_BITS 12              // Owner field of a held lock: the EBR id of the thread holding it
+#define LOCK_VERSION_SHIFT (1 + LOCK_OWNER_BITS)  // Lock word: version, owner id, lock bit
+#define LOCK_SPINS_ENV "TM_LOCK_SPINS"  // Pauses a transaction waits for a held stripe before aborting (0: abort at once)
+#define DEFAULT_LOCK_SPINS 128
+#define CLOCK_ENV "TM_CLOCK"            // Clock scheme of new regions: "gv1" (default), "gv4", "gv5" or "gv6" (TL2 engines)
+#define CLOCK_GV6_PERIOD 32             // GV6: one commit out of this many per thread and region increments the clock
+#define CLOCK_GV6_THREAD_SLOTS 4        // GV6: regions a thread counts its commits for at the same time
+#define CLOCK_CACHE_LINE 64             // The global clock gets a cache line of its own
+
+// norec.h
+#define NOREC_READ_LOG_INITIAL_CAPACITY 64     // Entries of a new value-based read log
+
+// eager.h
+#define EAGER_UNDO_LOG_INITIAL_CAPACITY 64      // Entries of a new undo log
+
+// dv.h
+#define DV_SEGMENT_SHIFT 48             // Addresses are (segment id << DV_SEGMENT_SHIFT) | offset
+#define DV_MAX_SEGMENTS 16384
+#define DV_BASE_SEGMENT 1               // Segment id 0 is never used, so no address is NULL
+#define DV_READABLE ((uintptr_t) 0x1)           // Control word: index of the readable copy
+#define DV_WRITTEN ((uintptr_t) 0x2)            // Control word: written in the current epoch
+#define DV_ACCESS_MANY (~(uintptr_t) 0x3)       // Control word: accessed by several transactions
+#define DV_ACCESS_MASK DV_ACCESS_MANY           // Control word: transaction that accessed the word
 
 // ============== helper methods ============== 
 static inline size_t set_hash(void const *key, size_t capacity) {
@@ -41,10 +127,6 @@ static inline size_t set_hash(void const *key, size_t capacity) {
     return k % capacity;
 }
 
-static inline uintptr_t get_memory_lock_index(void const *addr) {
-    return set_hash(addr, VLOCK_NUM);
-}
-
 static inline void set_bit(uint64_t bit_field[], size_t bit) {
     size_t bit_index = bit >> 6;            // division by 64
     size_t bit_offset = bit & 0x3F;         // modulo 64
@@ -59,6 +141,17 @@ static inline bool get_bit(uint64_t bit_field[], size_t bit) {
     return bit_field[bit_index] & (1ULL << bit_offset);
 }
 
+/**
+ * Hint the processor that the thread is spinning
+ */
+static inline void spin_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
 // ============== Debug ==============
 // Debug prints
 #define COLOR_RESET   "\033[0m"
@@ -2,274 +2,292 @@
 
 // ============== helper methods ==============
 /**
- * Find the index of the entry containing this target. 
- * If not contained in the set, return set->capacity
+ * Find the slot containing this target, or the free slot where it should be inserted.
  */
-static size_t set_find(struct set_t *set, void const *target);
+static size_t w_set_find(struct w_set_t *set, void const *target);
 
 /**
- * Find the next ideal available bucket for the target
- */ 
-static size_t set_find_next_free(struct set_t *set, void const *target);
-
-static void w_set_add_help(struct set_t *set, write_entry_t *entry);
-
-static void r_set_add_help(struct set_t *set, read_entry_t *entry);
-
-// ============== entry_t methods ============== 
-read_entry_t *r_entry_create(void *target) {
-    // Allocate memory for struct
-    read_entry_t *entry = malloc(sizeof(read_entry_t));
-    if (unlikely(!entry)) return NULL;
+ * qsort comparator for stripe indices
+ */
+static int stripe_cmp(void const *a, void const *b);
 
-    entry->target = target;
-    return entry;
+/**
+ * Size of a slot: target pointer, then the word, padded so the next target pointer stays aligned
+ */
+static inline size_t w_set_slot_size(size_t word_size) {
+    return (sizeof(void *) + word_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
 }
 
-write_entry_t *w_entry_create(void const *source, size_t size, void *target) {
-    // Allocate memory for struct
-    write_entry_t *entry = malloc(sizeof(write_entry_t));
-    if (unlikely(!entry)) return NULL;
-
-    // Try allocating memory for data 
-    entry->data = malloc(size);
-    if (unlikely(!(entry->data))) {
-        free(entry);
+// ============== r_log_t methods ============== 
+struct r_log_t *r_log_init(void) {
+    struct r_log_t *log = malloc(sizeof(struct r_log_t));
+    if (unlikely(!log)) {
+        LOG_TEST("r_log_init: initial log allocation failed!\n");
         return NULL;
     }
 
-    entry->base.target = target;
-    memcpy(entry->data, source, size);
+    log->count = 0;
+    log->capacity = INITIAL_CAPACITY;
+    log->stripes = malloc(log->capacity * sizeof(stripe_t));
+    if (unlikely(!log->stripes)) {
+        LOG_TEST("r_log_init: log->stripes allocation failed!\n");
+        free(log);
+        return NULL;
+    }
 
-    return entry;
+    // calloc: generation 0 slots are free, the log starts at generation 1
+    log->slot_capacity = 2 * log->capacity;
+    log->generation = 1;
+    log->slots = calloc(log->slot_capacity, sizeof(struct r_log_slot_t));
+    if (unlikely(!log->slots)) {
+        LOG_TEST("r_log_init: log->slots allocation failed!\n");
+        free(log->stripes);
+        free(log);
+        return NULL;
+    }
+    return log;
 }
 
-bool w_entry_update(write_entry_t *entry, void const *source, size_t size) {
-    if (unlikely(!entry)) return false;
-
-    // Update write entry
-    memcpy(entry->data, source, size);
+bool r_log_grow(struct r_log_t *log) {
+    if (unlikely(!log)) return false;
+
+    stripe_t *stripes = realloc(log->stripes, log->capacity * GROW_FACTOR * sizeof(stripe_t));
+    if (unlikely(!stripes)) return false;
+    log->stripes = stripes;
+
+    struct r_log_slot_t *slots = calloc(2 * log->capacity * GROW_FACTOR, sizeof(struct r_log_slot_t));
+    if (unlikely(!slots)) return false;
+    free(log->slots);
+    log->slots = slots;
+    log->slot_capacity = 2 * log->capacity * GROW_FACTOR;
+    log->capacity *= GROW_FACTOR;
+
+    // Rehash the logged stripes
+    log->generation = 1;
+    for (size_t i = 0; i < log->count; i++) {
+        struct r_log_slot_t *slot = r_log_find(log, log->stripes[i]);
+        slot->stripe = log->stripes[i];
+        slot->generation = log->generation;
+    }
     return true;
 }
 
-void r_entry_free(read_entry_t *entry) {
-    if (unlikely(!entry)) return;
-    free(entry);
+void r_log_reset(struct r_log_t *log) {
+    log->count = 0;
+    if (unlikely(++log->generation == 0)) {
+        // Generations wrapped around: stale slots could pass for current ones
+        memset(log->slots, 0, log->slot_capacity * sizeof(struct r_log_slot_t));
+        log->generation = 1;
+    }
 }
 
-void w_entry_free(write_entry_t *entry) {
-    if (unlikely(!entry)) return;
-    free(entry->data);
-    free(entry);
+void r_log_free(struct r_log_t *log) {
+    if (unlikely(!log)) return;
+    free(log->stripes);
+    free(log->slots);
+    free(log);
 }
 
-// ============== set_t methods ============== 
-struct set_t *set_init(bool is_write_set, size_t data_size) {
-    // Allocate memory for the set_t structure
-    struct set_t *set = (struct set_t *)malloc(sizeof(struct set_t));
+size_t r_log_size(struct r_log_t *log) {
+    return log->count;
+}
+
+// ============== w_set_t methods ============== 
+struct w_set_t *w_set_init(size_t word_size) {
+    struct w_set_t *set = malloc(sizeof(struct w_set_t));
     if (unlikely(!set)) {
-        LOG_TEST("set_init: initial set allocation failed!\n");
+        LOG_TEST("w_set_init: initial set allocation failed!\n");
         return NULL;
     }
 
-    set->entries = calloc(INITIAL_CAPACITY, sizeof(struct base_entry_t *));
-    if (unlikely(!set->entries)) {
-        LOG_TEST("set_init: set->entries allocation failed!\n");
-        free(set);
-        return NULL;
-    }
+    set->word_size = word_size;
+    set->slot_size = w_set_slot_size(word_size);
+    set->count = 0;
+    set->capacity = INITIAL_CAPACITY;
 
-    size_t num_words = (INITIAL_CAPACITY + 63) / 64;
-    set->occupied_field = calloc(num_words, sizeof(uint64_t));
-    if (unlikely(!set->occupied_field)) {
-        LOG_TEST("set_init: set->occupied_field allocation failed!\n");
-        free(set->entries);
+    set->slots = calloc(set->capacity, set->slot_size);
+    if (unlikely(!set->slots)) {
+        LOG_TEST("w_set_init: set->slots allocation failed!\n");
         free(set);
         return NULL;
     }
-
-    // Initialize attributes
-    set->is_write_set = is_write_set;
-    set->data_size = data_size;
-    set->count = 0;
-    set->capacity = INITIAL_CAPACITY;
-  
     return set;
 }
 
-bool w_set_add(struct set_t *set, void const *source, size_t size, void *target) {
+bool w_set_add(struct w_set_t *set, void const *source, void *target) {
     if (unlikely(!set)) return false;
-    if (unlikely(size != set->data_size)) return false;
-    
+
     // Increase capacity if needed
-    LOG_DEBUG("w_set_add: adding element to set %p of size %lu and capacity %lu\n", size, set->count, set->capacity);
+    LOG_DEBUG("w_set_add: adding element to set %p of size %lu and capacity %lu\n", set, set->count, set->capacity);
     if (unlikely(set->count >= set->capacity * MAX_LOAD_FACTOR)) {
-        if (unlikely(!set_grow(set))) {
+        if (unlikely(!w_set_grow(set))) {
             LOG_WARNING("w_set_add: failed to grow size of set %p\n", set);
             return false;
         }
         LOG_DEBUG("w_set_add: increased capacity of set %p to %lu\n", set, set->capacity);
     }
 
-    // See if target is already in set and update
-    size_t index = set_find(set, target);
-    LOG_DEBUG("w_set_add: target %p in set %p (set->capacity=%lu) has: hash=%lu, index=%lu\n", target, set, set->capacity, set_hash(target, set->capacity), index);
-    if (likely(index != set->capacity)) {
-        write_entry_t *w_entry = (write_entry_t *) set->entries[index];
-        return w_entry_update(w_entry, source, size);
-    }
-
-    // Create a new write entry
-    write_entry_t *entry = w_entry_create(source, size, target);
-    if (unlikely(!entry)) {
-        LOG_WARNING("w_set_add: failed to initialize write_entry_t in set %p\n", set);
-        return false;
+    // Either the slot already holding target (update in place) or the free slot to claim
+    size_t index = w_set_find(set, target);
+    char *slot = set->slots + index * set->slot_size;
+    if (likely(!*(void **)slot)) {
+        *(void **)slot = target;
+        set->count++;
     }
-    w_set_add_help(set, entry);
-    set->count++;
-
+    memcpy(slot + sizeof(void *), source, set->word_size);
     return true;
 }
 
-bool r_set_add(struct set_t* set, void* target) {
+bool w_set_reset(struct w_set_t *set, size_t word_size) {
     if (unlikely(!set)) return false;
-
-    // Increase capacity if needed
-    if (unlikely(set->count >= set->capacity * MAX_LOAD_FACTOR)) {
-        if (unlikely(!set_grow(set))) {
-            LOG_WARNING("w_set_add: failed to grow size of set %p\n", set);
-            return false;
-        }
+    size_t slot_size = w_set_slot_size(word_size);
+
+    if (unlikely(slot_size != set->slot_size || set->capacity > W_SET_MAX_CACHED_CAPACITY)) {
+        // Start over from a fresh table of initial capacity
+        char *slots = calloc(INITIAL_CAPACITY, slot_size);
+        if (unlikely(!slots)) return false;
+        free(set->slots);
+        set->slots = slots;
+        set->slot_size = slot_size;
+        set->capacity = INITIAL_CAPACITY;
+    } else if (set->count > 0) {
+        memset(set->slots, 0, set->capacity * set->slot_size);
     }
 
-    // See if target is already in set and update
-    size_t index = set_find(set, target);
-    if (unlikely(index != set->capacity)) return true;
-
-    // Create a new write entry
-    read_entry_t *entry = r_entry_create(target);
-    if (unlikely(!entry)) return false;  
-    r_set_add_help(set, entry);
-    set->count++;
-
+    set->word_size = word_size;
+    set->count = 0;
     return true;
 }
 
-struct base_entry_t *set_get(struct set_t *set, void *key) {
+void *w_set_get(struct w_set_t *set, void const *target) {
     if (unlikely(!set)) return NULL;
-    
-    size_t index = set_find(set, key);
-    if (unlikely(index != set->capacity)) return set->entries[index];
+
+    size_t index = w_set_find(set, target);
+    char *slot = set->slots + index * set->slot_size;
+    if (unlikely(*(void **)slot)) return slot + sizeof(void *);
     return NULL;
 }
 
-void set_free(struct set_t *set) {
+void w_set_free(struct w_set_t *set) {
     if (unlikely(!set)) return;
-
-    // Iterate through all entries and free the dynamically allocated resources
-    for (size_t i = 0; i < set->capacity; i++) {
-        if (get_bit(set->occupied_field, i)) {
-            if (set->is_write_set) {
-                w_entry_free((write_entry_t *)set->entries[i]);
-            }
-            else {
-                r_entry_free((read_entry_t *)set->entries[i]);
-            }
-        }
-    }
-
-    // Free the dynamically allocated array of pointers
-    free(set->entries);
-    free(set->occupied_field);
-
-    // Free the set_t structure
+    free(set->slots);
     free(set);
 }
 
-size_t set_size(struct set_t *set) {
+size_t w_set_size(struct w_set_t *set) {
     return set->count;
 }
 
-bool set_grow(struct set_t *set) {
+bool w_set_grow(struct w_set_t *set) {
     if (unlikely(!set)) return false;
     size_t old_capacity = set->capacity;
-    struct base_entry_t **old_entries = set->entries;
-    uint64_t *old_occupied = set->occupied_field;
-
-    // Allocate new memroy bloc of increased size
-    set->capacity *= GROW_FACTOR;
-    set->entries = calloc(set->capacity, sizeof(struct base_entry_t *));
-
-    size_t num_words = (set->capacity + 63) / 64;   // if set->capacity is smaller than 64, straight division by 64 = 0, so use +63 to get minimum size of 1S
-    set->occupied_field = calloc(num_words, sizeof(uint64_t));
-    if (unlikely(!set->entries || !set->occupied_field)) {
-        free(old_entries);
-        free(old_occupied);
-        return false;
-    }
+    char *old_slots = set->slots;
+
+    // Allocate new memory block of increased size
+    char *slots = calloc(old_capacity * GROW_FACTOR, set->slot_size);
+    if (unlikely(!slots)) return false;
+    set->slots = slots;
+    set->capacity = old_capacity * GROW_FACTOR;
 
+    // re-hash: targets are unique, so each one goes to the first free slot of its probe sequence
     for (size_t i = 0; i < old_capacity; i++) {
-        if (get_bit(old_occupied, i)) {
-            // re-hash
-            if (set->is_write_set) {
-                w_set_add_help(set, (write_entry_t *) old_entries[i]);
-            } else {
-                r_set_add_help(set, (read_entry_t *) old_entries[i]);
-            }
+        char *old_slot = old_slots + i * set->slot_size;
+        void *target = *(void **)old_slot;
+        if (target) {
+            size_t index = w_set_find(set, target);
+            memcpy(set->slots + index * set->slot_size, old_slot, set->slot_size);
         }
     }
 
-    free(old_entries);
-    free(old_occupied);
+    free(old_slots);
     return true;
 }
 
-void set_get_lock_field(struct set_t *set, uint64_t *lock_field) {
-    if (unlikely(!set || !lock_field)) return;
-    if (unlikely(!set->is_write_set)) return;   // Can only use on write sets
-
-    memset(lock_field, 0, (VLOCK_NUM / 64) * sizeof(uint64_t));
+bool w_set_get_lock_set(struct w_set_t *set, struct lock_set_t *locks, stripe_t (*stripe_of)(void *context, void const *target), void *context) {
+    if (unlikely(!set || !locks)) return false;
+
+    // There are at most as many stripes as words
+    if (unlikely(locks->capacity < set->count)) {
+        size_t capacity = locks->capacity;
+        while (capacity < set->count) capacity *= GROW_FACTOR;
+        stripe_t *stripes = realloc(locks->stripes, capacity * sizeof(stripe_t));
+        if (unlikely(!stripes)) return false;
+        locks->stripes = stripes;
+        locks->capacity = capacity;
+    }
 
+    size_t count = 0;
     for (size_t i = 0; i < set->capacity; i++) {
-        if (get_bit(set->occupied_field, i)) {
-            void *target = set->entries[i]->target;
-            int lock_index = get_memory_lock_index(target);
-        
-            set_bit(lock_field, lock_index);
+        void *target = w_set_slot_target(set, i);
+        if (target) {
+            locks->stripes[count++] = stripe_of(context, target);
         }
     }
-}
 
-// ============= helper methods implementation =============
-size_t set_find(struct set_t *set, void const *target) {
-    size_t index = set_hash(target, set->capacity);
+    // Sort: insertion sort for the usual handful of words
+    if (likely(count <= LOCK_SET_SORT_THRESHOLD)) {
+        for (size_t i = 1; i < count; i++) {
+            stripe_t stripe = locks->stripes[i];
+            size_t j = i;
+            for (; j > 0 && locks->stripes[j - 1] > stripe; j--) {
+                locks->stripes[j] = locks->stripes[j - 1];
+            }
+            locks->stripes[j] = stripe;
+        }
+    } else {
+        qsort(locks->stripes, count, sizeof(stripe_t), stripe_cmp);
+    }
 
-    // Linear probing to find the target in the table, if an empty bucket is encountered, then the value is not in the set
-    while (get_bit(set->occupied_field, index)) {
-        if (likely(set->entries[index]->target == target)) return index;
-        index = (index + 1) % set->capacity;
+    // Remove duplicates (words sharing a stripe)
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (distinct == 0 || locks->stripes[distinct - 1] != locks->stripes[i]) {
+            locks->stripes[distinct++] = locks->stripes[i];
+        }
     }
-    return set->capacity;
+    locks->count = distinct;
+    return true;
 }
 
-size_t set_find_next_free(struct set_t *set, void const *target) {
-    size_t index = set_hash(target, set->capacity);
+// ============== lock_set_t methods ============== 
+struct lock_set_t *lock_set_init(void) {
+    struct lock_set_t *locks = malloc(sizeof(struct lock_set_t));
+    if (unlikely(!locks)) {
+        LOG_TEST("lock_set_init: initial lock set allocation failed!\n");
+        return NULL;
+    }
 
-    // Linear probing to find the first empty slot in the table
-    while (get_bit(set->occupied_field, index)) {
-        index = (index + 1) % set->capacity;
+    locks->count = 0;
+    locks->capacity = INITIAL_CAPACITY;
+    locks->stripes = malloc(locks->capacity * sizeof(stripe_t));
+    if (unlikely(!locks->stripes)) {
+        LOG_TEST("lock_set_init: locks->stripes allocation failed!\n");
+        free(locks);
+        return NULL;
     }
-    return index;
+    return locks;
 }
 
-void w_set_add_help(struct set_t *set, write_entry_t *entry) {
-    size_t index = set_find_next_free(set, entry->base.target);
-    set->entries[index] = (struct base_entry_t *)entry;
-    set_bit(set->occupied_field, index);
+void lock_set_free(struct lock_set_t *locks) {
+    if (unlikely(!locks)) return;
+    free(locks->stripes);
+    free(locks);
 }
 
-void r_set_add_help(struct set_t *set, read_entry_t *entry) {
-    size_t index = set_find_next_free(set, entry->target);
-    set->entries[index] = (struct base_entry_t *)entry;
-    set_bit(set->occupied_field, index);
+// ============= helper methods implementation =============
+size_t w_set_find(struct w_set_t *set, void const *target) {
+    size_t index = set_hash(target, set->capacity);
+
+    // Linear probing until either target or a free slot is found
+    while (true) {
+        void *slot_target = w_set_slot_target(set, index);
+        if (likely(!slot_target || slot_target == target)) return index;
+        index = (index + 1) % set->capacity;
+    }
 }
+
+int stripe_cmp(void const *a, void const *b) {
+    stripe_t x = *(stripe_t const *)a;
+    stripe_t y = *(stripe_t const *)b;
+    return (x > y) - (x < y);
+}
\ No newline at end of file
@@ -12,130 +12,214 @@
 #include "macros.h"
 
 /**
- * @brief Base entry for read/write sets.
- * Read entries only use the target field.
- * @param target pointer to target memory location
+ * @brief Slot of the r_log_t stripe set, holding a stripe iff it is of the current generation.
  */
-struct base_entry_t {
-    void *target;
+struct r_log_slot_t {
+    stripe_t stripe;
+    uint32_t generation;
 };
 
 /**
- * @brief Write entry extends base_entry_t with data to write.
- * @param base   base entry containing target pointer
- * @param size   size of buffer to be written
- * @param data   data to be written
+ * @brief read log implementation.
+ * Append-only log of the v_lock stripe indices read by a read-write transaction. An open-addressing
+ * set of the logged stripes filters out stripes which are already logged (stripes span the lock tables
+ * of every segment, too many for a bitmap); its slots are stamped with the generation of the log, so
+ * resetting only starts a new generation.
+ * @param stripes       logged stripe indices
+ * @param slots         set of the logged stripes, slot_capacity slots (a power of two, twice capacity)
+ * @param generation    slots of other generations are free
  */
-typedef struct write_entry_t {
-    struct base_entry_t base;
-    void *data;
-} write_entry_t;
-
-typedef struct base_entry_t read_entry_t;
+struct r_log_t {
+    stripe_t *stripes;
+    size_t count;
+    size_t capacity;
+    struct r_log_slot_t *slots;
+    size_t slot_capacity;
+    uint32_t generation;
+};
 
 /**
- * @brief read/write set implementation.
- * TODO: improve once solution works. (sort the elements progressively, use a tree, hash table)
- * Current implementation uses: Hash table
+ * @brief write set implementation.
+ * Open-addressing hash table stored in a single contiguous buffer. Each slot holds the target
+ * address followed inline by the word to be written, so adding, looking up and committing
+ * writes never touches the heap (except when the table has to grow).
+ * A slot whose target is NULL is free.
+ * @param word_size size in bytes of a word (alignment of the region)
+ * @param slot_size size in bytes of a slot (target pointer + word, padded to pointer alignment)
+ * @param slots     buffer of capacity * slot_size bytes
  */
-struct set_t {
-    bool is_write_set;
-    size_t data_size;
+struct w_set_t {
+    size_t word_size;
+    size_t slot_size;
+    char *slots;
+    size_t count;
+    size_t capacity;
+};
 
-    struct base_entry_t** entries;
-    uint64_t *occupied_field;
+/**
+ * @brief lock set implementation.
+ * Sorted array of the distinct stripe indices covering a write set, rebuilt at every commit so
+ * that locks are acquired in a global order and only the stripes actually written are visited.
+ */
+struct lock_set_t {
+    stripe_t *stripes;
     size_t count;
     size_t capacity;
 };
 
-// ============== entry_t methods ============== 
+// ============== r_log_t methods ============== 
 /**
- * Create a read entry
- * @param target pointer to target memory location
- * @return Pointer to created read entry, NULL on failure
+ * Initialize a r_log_t
+ * @return Pointer to initialized log, NULL on failure
  */
-read_entry_t *r_entry_create(void *target);
+struct r_log_t *r_log_init(void);
 
 /**
- * Create a write entry
- * @param source pointer to source data
- * @param size size in bytes of data
- * @param target pointer to target memory location
- * @return Pointer to created write entry, NULL on failure
+ * Grow the log capacity
+ * @param log the log to grow
+ * @return Whether the operation was a success
+ */
+bool r_log_grow(struct r_log_t *log);
+
+/**
+ * @return Slot holding the stripe, or the free slot where it should be inserted
  */
-write_entry_t *w_entry_create(void const *source, size_t size, void *target);
+static inline struct r_log_slot_t *r_log_find(struct r_log_t *log, stripe_t stripe) {
+    uint64_t hash = stripe ^ (stripe >> 32);
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+
+    size_t mask = log->slot_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct r_log_slot_t *slot = &log->slots[i];
+        if (slot->generation != log->generation || slot->stripe == stripe) return slot;
+    }
+}
 
 /**
- * Update a write entry's data
- * @param entry write entry to update
- * @param source pointer to new source data
- * @param size size in bytes of new data
+ * Add a stripe to the read log, unless it was already logged.
+ * @param log the log to add to
+ * @param stripe index of the v_lock covering the read location
  * @return Whether the operation was a success
  */
-bool w_entry_update(write_entry_t *entry, void const *source, size_t size);
+static inline bool r_log_add(struct r_log_t *log, stripe_t stripe) {
+    struct r_log_slot_t *slot = r_log_find(log, stripe);
+    if (likely(slot->generation == log->generation)) return true;
+
+    if (unlikely(log->count == log->capacity)) {
+        if (unlikely(!r_log_grow(log))) return false;
+        slot = r_log_find(log, stripe);
+    }
+    slot->stripe = stripe;
+    slot->generation = log->generation;
+    log->stripes[log->count++] = stripe;
+    return true;
+}
 
 /**
- * Free a read entry
- * @param entry entry to free
+ * Empty the log, keeping its capacity
+ * @param log the log to reset
  */
-void r_entry_free(read_entry_t *entry);
+void r_log_reset(struct r_log_t *log);
 
 /**
- * Free a write entry (frees both data and entry)
- * @param entry entry to free
+ * Free the log
+ * @param log the log to free
  */
-void w_entry_free(struct write_entry_t *entry);
+void r_log_free(struct r_log_t *log);
 
-// ============== set_t methods ============== 
 /**
- * Initialize a set_t
- * @param is_write_set whether this is a write set (true) or read set (false)
- * @return Pointer to initialized set
+ * Get the number of stripes in the log
+ * @param log the log to query
+ * @return Number of stripes
  */
-struct set_t *set_init(bool is_write_set, size_t data_size);
+size_t r_log_size(struct r_log_t *log);
 
+// ============== w_set_t methods ============== 
 /**
- * Add an element to the write set.
+ * Initialize a w_set_t
+ * @param word_size size in bytes of the words stored in the set
+ * @return Pointer to initialized set, NULL on failure
+ */
+struct w_set_t *w_set_init(size_t word_size);
+
+/**
+ * Add a word to the write set, or overwrite the buffered word if target is already in the set.
  * @param set the set to add to
- * @param source pointer to source write location
- * @param size size in bytes of value at source
+ * @param source pointer to the word to buffer (set->word_size bytes)
  * @param target pointer to target write location
  * @return Whether the operation was a success
  */
-bool w_set_add(struct set_t* set, void const *source, size_t size, void* target);
+bool w_set_add(struct w_set_t *set, void const *source, void *target);
 
 /**
- * Add an element to the read set.
- * @param set the set to add to
- * @param target pointer to target read location
+ * Empty the set so it can be reused by another transaction. The table keeps its capacity unless
+ * it is larger than W_SET_MAX_CACHED_CAPACITY or laid out for another word size.
+ * @param set the set to reset
+ * @param word_size size in bytes of the words the set will store
  * @return Whether the operation was a success
  */
-bool r_set_add(struct set_t* set, void* target);
+bool w_set_reset(struct w_set_t *set, size_t word_size);
 
 /**
- * Get pointer to entry with key key, else NULL
+ * Get the word buffered for target
+ * @return Pointer to the inline word, NULL if target is not in the set
  */
-struct base_entry_t *set_get(struct set_t *set, void *key);
+void *w_set_get(struct w_set_t *set, void const *target);
 
 /**
- * Free the set and all its entries
+ * Free the set
  * @param set the set to free
  */
-void set_free(struct set_t *set);
-
+void w_set_free(struct w_set_t *set);
 
 /**
- * Get the number of entries in the set
+ * Get the number of words in the set
  * @param set the set to query
- * @return Number of entries
+ * @return Number of words
  */
-size_t set_size(struct set_t *set);
+size_t w_set_size(struct w_set_t *set);
 
 /**
  * Grow the set capacity
  * @param set the set to grow
  * @return Whether the operation was a success
  */
-bool set_grow(struct set_t *set);
+bool w_set_grow(struct w_set_t *set);
+
+/**
+ * Fill locks with the sorted, distinct stripe indices of the targets in the write set
+ * @param set the write set
+ * @param locks the lock set to fill, grown if needed
+ * @param stripe_of stripe of a target, given context
+ * @return Whether the operation was a success
+ */
+bool w_set_get_lock_set(struct w_set_t *set, struct lock_set_t *locks, stripe_t (*stripe_of)(void *context, void const *target), void *context);
+
+/**
+ * @return Target address stored in slot i, NULL if the slot is free
+ */
+static inline void *w_set_slot_target(struct w_set_t *set, size_t i) {
+    return *(void **)(set->slots + i * set->slot_size);
+}
 
-void set_get_lock_field(struct set_t *set, uint64_t *lock_field);
+/**
+ * @return Pointer to the word stored inline in slot i
+ */
+static inline void *w_set_slot_data(struct w_set_t *set, size_t i) {
+    return set->slots + i * set->slot_size + sizeof(void *);
+}
+
+// ============== lock_set_t methods ============== 
+/**
+ * Initialize a lock_set_t
+ * @return Pointer to initialized lock set, NULL on failure
+ */
+struct lock_set_t *lock_set_init(void);
+
+/**
+ * Free the lock set
+ * @param locks the lock set to free
+ */
+void lock_set_free(struct lock_set_t *locks);
@@ -0,0 +1,67 @@
+#include "mv.h"
+
+// ============== helper methods ==============
+static inline struct mv_entry_t *mv_history_entry(struct mv_history_t *history, size_t i) {
+    return (struct mv_entry_t *) (history->entries + ((history->head + i) % MV_HISTORY_DEPTH) * history->entry_size);
+}
+
+/**
+ * Drop the oldest entry, remembering the versions that may now be missing
+ */
+static void mv_history_drop_oldest(struct mv_history_t *history);
+
+// ============== mv_history_t methods ==============
+struct mv_history_t *mv_history_create(size_t word_size) {
+    // Entry layout: header, then the word, padded so the next header stays aligned
+    size_t entry_size = (sizeof(struct mv_entry_t) + word_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    struct mv_history_t *history = malloc(sizeof(struct mv_history_t) + MV_HISTORY_DEPTH * entry_size);
+    if (unlikely(!history)) {
+        LOG_TEST("mv_history_create: history allocation failed!\n");
+        return NULL;
+    }
+
+    history->evicted_until = 0;
+    history->entry_size = entry_size;
+    history->head = 0;
+    history->count = 0;
+    return history;
+}
+
+void mv_history_push(struct mv_history_t *history, size_t word_size, void *target, void const *value, version_t until, version_t oldest_snapshot) {
+    // Garbage-collect the entries that no active snapshot can read anymore
+    while (history->count > 0 && mv_history_entry(history, 0)->until <= oldest_snapshot) {
+        mv_history_drop_oldest(history);
+    }
+    if (unlikely(history->count == MV_HISTORY_DEPTH)) {
+        mv_history_drop_oldest(history);
+    }
+
+    struct mv_entry_t *entry = mv_history_entry(history, history->count);
+    entry->until = until;
+    entry->target = target;
+    memcpy(entry + 1, value, word_size);
+    history->count++;
+}
+
+enum mv_lookup_t mv_history_lookup(struct mv_history_t *history, size_t word_size, void const *target, version_t rv, void *value) {
+    if (unlikely(history->evicted_until > rv)) return MV_EVICTED;
+
+    // Entries are ordered by version: the first one of target overwritten after rv holds its value at rv
+    for (size_t i = 0; i < history->count; i++) {
+        struct mv_entry_t *entry = mv_history_entry(history, i);
+        if (entry->target == target && entry->until > rv) {
+            memcpy(value, entry + 1, word_size);
+            return MV_FOUND;
+        }
+    }
+    return MV_CURRENT;
+}
+
+// ============= helper methods implementation =============
+static void mv_history_drop_oldest(struct mv_history_t *history) {
+    version_t until = mv_history_entry(history, 0)->until;
+    if (until > history->evicted_until) history->evicted_until = until;
+    history->head = (history->head + 1) % MV_HISTORY_DEPTH;
+    history->count--;
+}
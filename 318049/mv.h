@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "macros.h"
+
+/**
+ * @brief Overwritten word kept in a stripe history.
+ * The word value follows the entry inline.
+ * @param until  write version of the commit that overwrote the value: it was current for versions < until
+ * @param target address of the word
+ */
+struct mv_entry_t {
+    version_t until;
+    void *target;
+};
+
+/**
+ * @brief Bounded version history of one stripe (multi-version mode).
+ * Ring of the last MV_HISTORY_DEPTH words overwritten in the stripe, oldest first. Entries are
+ * only pushed by the committer holding the stripe lock; readers validate what they read with
+ * the stripe version, as for shared memory.
+ * @param evicted_until greatest `until` of the entries dropped so far: snapshots older than it may miss a value
+ * @param head          index of the oldest entry
+ * @param count         number of entries
+ * @param entries       MV_HISTORY_DEPTH entries of entry_size bytes
+ */
+struct mv_history_t {
+    version_t evicted_until;
+    size_t entry_size;
+    size_t head;
+    size_t count;
+    char entries[];
+};
+
+/**
+ * Result of a history lookup
+ */
+enum mv_lookup_t {
+    MV_FOUND,       // The value at the snapshot was copied from the history
+    MV_CURRENT,     // The word was not overwritten since the snapshot: its current value is the one at the snapshot
+    MV_EVICTED,     // The value at the snapshot may have been dropped from the history
+};
+
+/**
+ * Create an empty history
+ * @param word_size size in bytes of the words of the region
+ * @return Pointer to the history, NULL on failure
+ */
+struct mv_history_t *mv_history_create(size_t word_size);
+
+/**
+ * Record that the word at target, currently holding value, is overwritten by the commit of version until.
+ * Entries no snapshot can need anymore (until <= oldest_snapshot) are garbage-collected first; if the
+ * history is still full, its oldest entry is evicted.
+ * @param history the stripe history, its stripe lock must be held
+ * @param word_size size in bytes of the words of the region
+ * @param target address of the word
+ * @param value current (soon overwritten) value of the word
+ * @param until write version of the overwriting commit
+ * @param oldest_snapshot oldest read version of the active read-only transactions
+ */
+void mv_history_push(struct mv_history_t *history, size_t word_size, void *target, void const *value, version_t until, version_t oldest_snapshot);
+
+/**
+ * Look up the value the word at target had at version rv
+ * @param history the stripe history
+ * @param word_size size in bytes of the words of the region
+ * @param target address of the word
+ * @param rv read version of the snapshot
+ * @param value buffer receiving the value if MV_FOUND
+ * @return see mv_lookup_t
+ */
+enum mv_lookup_t mv_history_lookup(struct mv_history_t *history, size_t word_size, void const *target, version_t rv, void *value);
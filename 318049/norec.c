@@ -0,0 +1,304 @@
+/**
+ * @file   norec.c
+ *
+ * @section DESCRIPTION
+ *
+ * NOrec engine: no per-location metadata, a single global sequence lock (the region version
+ * clock), value-based validation of reads and write-back of buffered writes one commit at a time.
+ * Memory management is the one of the TL2 regions (shared.c).
+**/
+
+#include "norec.h"
+
+// ------- sequence lock -------
+
+/**
+ * Wait until no transaction writes back
+ * @return Current (even) sequence number
+ */
+static inline version_t norec_seqlock_stable(struct region_t *region) {
+    version_t seq;
+    while (unlikely((seq = atomic_load(&region->version_clock)) & 1));
+    return seq;
+}
+
+// ------- transactions -------
+
+/**
+ * Compare every logged read against memory, at a stable sequence number
+ * @return New snapshot at which all reads are still consistent, INVALID if a value changed
+ */
+static version_t norec_validate(struct region_t *region, struct norec_txn_t *txn);
+
+/**
+ * Append the word read at source to the value log
+ */
+static bool norec_log_read(struct norec_txn_t *txn, void const *source, void const *value);
+
+/**
+ * Leave the epoch and return the descriptor to the pool
+ */
+static void norec_release(struct norec_txn_t *txn);
+
+/**
+ * Roll back the allocations, drop the frees and release the descriptor
+ */
+static void norec_abort(struct region_t *region, struct norec_txn_t *txn);
+
+static struct norec_txn_t *norec_txn_alloc(size_t word_size);
+
+static void norec_txn_pool_destroy(struct desc_pool_node_t *node);
+
+static _Thread_local struct desc_pool_t norec_txn_pool = { .destroy = norec_txn_pool_destroy };
+
+// ============================================= engine functions =============================================
+
+static shared_t norec_create(size_t size, size_t align) {
+    struct region_t *region = region_create_unlocked(size, align);
+    if (unlikely(!region)) {
+        LOG_WARNING("norec_create: shared memory region creation failed.\n");
+        return invalid_shared;
+    }
+    region->engine = &norec_engine;
+    return (shared_t) region;
+}
+
+static void norec_destroy(shared_t shared) {
+    region_destroy((struct region_t *) shared);
+}
+
+static void* norec_start(shared_t shared) {
+    return region_start((struct region_t *) shared);
+}
+
+static size_t norec_size(shared_t shared) {
+    return region_size((struct region_t *) shared);
+}
+
+static size_t norec_align(shared_t shared) {
+    return region_align((struct region_t *) shared);
+}
+
+static tx_t norec_begin(shared_t shared, bool is_ro) {
+    struct region_t *region = (struct region_t *) shared;
+    // Keeps the segments this transaction may access from being reclaimed
+    if (unlikely(!ebr_enter())) {
+        LOG_TEST("norec_begin: epoch registration failed!\n");
+        return invalid_tx;
+    }
+
+    struct norec_txn_t *txn = desc_pool_take(&norec_txn_pool);
+    if (unlikely(!txn)) {
+        txn = norec_txn_alloc(region->align);
+        if (unlikely(!txn)) {
+            LOG_TEST("norec_begin: memory allocation for transaction failed!\n");
+            ebr_leave();
+            return invalid_tx;
+        }
+    }
+
+    if (unlikely(!w_set_reset(txn->w_set, region->align))) {
+        LOG_TEST("norec_begin: write set reset failed!\n");
+        norec_release(txn);
+        return invalid_tx;
+    }
+    txn->is_ro = is_ro;
+    txn->entry_size = sizeof(void *) + region->align;
+    txn->read_count = 0;
+    txn->frees.count = 0;
+    txn->allocs.count = 0;
+    txn->snapshot = norec_seqlock_stable(region);
+    return (tx_t) txn;
+}
+
+static bool norec_end(shared_t shared, tx_t tx) {
+    struct region_t *region = (struct region_t *) shared;
+    struct norec_txn_t *txn = (struct norec_txn_t *) tx;
+
+    // Transactions without writes are consistent at their snapshot: nothing to write back
+    if (unlikely(!txn->is_ro && txn->w_set->count > 0)) {
+        // Take the sequence lock, revalidating whenever another transaction committed meanwhile
+        version_t snapshot = txn->snapshot;
+        while (!atomic_compare_exchange_strong(&region->version_clock, &snapshot, txn->snapshot + 1)) {
+            snapshot = norec_validate(region, txn);
+            if (unlikely(snapshot == INVALID)) {
+                LOG_WARNING("norec_end: transaction %lu failed to validate its reads!\n", tx);
+                norec_abort(region, txn);
+                return ABORT;
+            }
+            txn->snapshot = snapshot;
+        }
+
+        // Write back
+        struct w_set_t *ws = txn->w_set;
+        for (size_t i = 0; i < ws->capacity; i++) {
+            void *target = w_set_slot_target(ws, i);
+            if (target) memcpy(target, w_set_slot_data(ws, i), ws->word_size);
+        }
+        atomic_store(&region->version_clock, txn->snapshot + 2);
+    }
+
+    // Committed: the allocations stay and the frees apply
+    bool should_free_region = region_commit_logs(region, &txn->allocs, &txn->frees);
+
+    norec_release(txn);
+
+    if (unlikely(should_free_region)) region_schedule_free(region);
+    return SUCCESS;
+}
+
+static bool norec_read(shared_t shared, tx_t tx, void const *source, size_t size, void *target) {
+    struct region_t *region = (struct region_t *) shared;
+    struct norec_txn_t *txn = (struct norec_txn_t *) tx;
+    size_t word_size = region->align;
+
+    for (size_t i = 0; i < size; i += word_size) {
+        void const *source_addr = (char const *) source + i;
+        void *target_addr = (char *) target + i;
+
+        if (unlikely(!txn->is_ro)) {
+            // Read-after-write
+            void *data = w_set_get(txn->w_set, source_addr);
+            if (unlikely(data)) {
+                memcpy(target_addr, data, word_size);
+                continue;
+            }
+        }
+
+        // The value read is consistent with the snapshot only if no commit happened meanwhile
+        memcpy(target_addr, source_addr, word_size);
+        while (unlikely(atomic_load(&region->version_clock) != txn->snapshot)) {
+            version_t snapshot = norec_validate(region, txn);
+            if (unlikely(snapshot == INVALID)) {
+                LOG_WARNING("norec_read: transaction %lu failed to validate its reads!\n", tx);
+                norec_abort(region, txn);
+                return ABORT;
+            }
+            txn->snapshot = snapshot;
+            memcpy(target_addr, source_addr, word_size);
+        }
+
+        if (unlikely(!norec_log_read(txn, source_addr, target_addr))) {
+            LOG_WARNING("norec_read: transaction %lu failed to log a read!\n", tx);
+            norec_abort(region, txn);
+            return ABORT;
+        }
+    }
+    return SUCCESS;
+}
+
+static bool norec_write(shared_t shared, tx_t tx, void const *source, size_t size, void *target) {
+    struct region_t *region = (struct region_t *) shared;
+    struct norec_txn_t *txn = (struct norec_txn_t *) tx;
+    size_t word_size = region->align;
+
+    for (size_t i = 0; i < size; i += word_size) {
+        if (unlikely(!w_set_add(txn->w_set, (char const *) source + i, (char *) target + i))) {
+            LOG_WARNING("norec_write: transaction %lu failed to add a word to its write set!\n", tx);
+            norec_abort(region, txn);
+            return ABORT;
+        }
+    }
+    return SUCCESS;
+}
+
+static alloc_t norec_alloc(shared_t shared, tx_t tx, size_t size, void **target) {
+    struct segment_node_t *node = region_alloc_logged((struct region_t *) shared, &((struct norec_txn_t *) tx)->allocs, size);
+    if (unlikely(!node)) {
+        LOG_WARNING("norec_alloc: transaction %lu allocation failed\n", tx);
+        return nomem_alloc;
+    }
+
+    void *data = (void *) ((uintptr_t) node + sizeof(struct segment_node_t));
+    *target = data;
+    return success_alloc;
+}
+
+static bool norec_free(shared_t unused(shared), tx_t tx, void *target) {
+    return free_log_add(&((struct norec_txn_t *) tx)->frees, target) ? SUCCESS : ABORT;
+}
+
+struct engine_t const norec_engine = {
+    .name    = "norec",
+    .create  = norec_create,
+    .destroy = norec_destroy,
+    .start   = norec_start,
+    .size    = norec_size,
+    .align   = norec_align,
+    .begin   = norec_begin,
+    .end     = norec_end,
+    .read    = norec_read,
+    .write   = norec_write,
+    .alloc   = norec_alloc,
+    .free    = norec_free,
+};
+
+// ============================================= static functions implementation =============================================
+static version_t norec_validate(struct region_t *region, struct norec_txn_t *txn) {
+    size_t word_size = region->align;
+
+    while (true) {
+        version_t seq = norec_seqlock_stable(region);
+        for (size_t i = 0; i < txn->read_count; i++) {
+            char *entry = txn->reads + i * txn->entry_size;
+            void *source = *(void **) entry;
+            if (memcmp(source, entry + sizeof(void *), word_size) != 0) return INVALID;
+        }
+        // The comparison is only meaningful if no commit overlapped it
+        if (likely(atomic_load(&region->version_clock) == seq)) return seq;
+    }
+}
+
+static bool norec_log_read(struct norec_txn_t *txn, void const *source, void const *value) {
+    if (unlikely((txn->read_count + 1) * txn->entry_size > txn->read_capacity)) {
+        size_t capacity = (txn->read_capacity + txn->entry_size) * GROW_FACTOR;
+        char *reads = realloc(txn->reads, capacity);
+        if (unlikely(!reads)) return false;
+        txn->reads = reads;
+        txn->read_capacity = capacity;
+    }
+
+    char *entry = txn->reads + txn->read_count++ * txn->entry_size;
+    *(void const **) entry = source;
+    memcpy(entry + sizeof(void *), value, txn->entry_size - sizeof(void *));
+    return true;
+}
+
+static void norec_abort(struct region_t *region, struct norec_txn_t *txn) {
+    if (unlikely(txn->allocs.count > 0)) region_rollback_allocs(region, &txn->allocs);
+    norec_release(txn);
+}
+
+static void norec_release(struct norec_txn_t *txn) {
+    ebr_leave();
+
+    desc_pool_put(&norec_txn_pool, txn);
+}
+
+static void norec_txn_pool_destroy(struct desc_pool_node_t *node) {
+    struct norec_txn_t *txn = (struct norec_txn_t *) node;
+    free(txn->reads);
+    w_set_free(txn->w_set);
+    free_log_free(&txn->frees);
+    alloc_log_free(&txn->allocs);
+    free(txn);
+}
+
+static struct norec_txn_t *norec_txn_alloc(size_t word_size) {
+    // Register the pool so that it is freed on thread exit
+    desc_pool_register(&norec_txn_pool);
+
+    struct norec_txn_t *txn = calloc(1, sizeof(struct norec_txn_t));
+    if (unlikely(!txn)) return NULL;
+
+    txn->read_capacity = NOREC_READ_LOG_INITIAL_CAPACITY * (sizeof(void *) + word_size);
+    txn->reads = malloc(txn->read_capacity);
+    txn->w_set = w_set_init(word_size);
+    if (unlikely(!txn->reads || !txn->w_set)) {
+        free(txn->reads);
+        if (txn->w_set) w_set_free(txn->w_set);
+        free(txn);
+        return NULL;
+    }
+    return txn;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "helper.h"
+#include "map.h"
+#include "pool.h"
+#include "shared.h"
+#include "tm.h"
+#include "macros.h"
+
+/**
+ * @brief NOrec transaction.
+ * The region version clock is used as a global sequence lock: it is odd while a transaction
+ * writes back, and a transaction is consistent as long as the clock still equals its snapshot.
+ * Reads are validated by value: every word read is logged with the value seen, and when the
+ * clock moved the log is compared against memory.
+ * @param snapshot    (even) clock value at which all reads so far are consistent
+ * @param reads       value log: read_count entries of entry_size bytes, each an address followed by the word read
+ * @param read_capacity size of reads in bytes (descriptors are reused across regions of different word sizes)
+ * @param w_set       buffered writes, written back under the sequence lock at commit
+ * @param frees       segments freed by the transaction, handed to the region once it committed
+ */
+struct norec_txn_t {
+    struct desc_pool_node_t pool_node;  // Link in the thread's descriptor pool, while this one is unused
+    bool is_ro;
+    version_t snapshot;
+
+    char *reads;
+    size_t entry_size;
+    size_t read_count;
+    size_t read_capacity;
+
+    struct w_set_t *w_set;
+
+    struct free_log_t frees;
+    struct alloc_log_t allocs;      // Segments allocated by the transaction, rolled back if it aborts
+};
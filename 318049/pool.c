@@ -0,0 +1,47 @@
+/**
+ * @file   pool.c
+ *
+ * @section DESCRIPTION
+ *
+ * Per-thread pools of transaction descriptors, shared by the engines: a single pthread key frees
+ * every pool a thread registered when it exits.
+**/
+
+#include "pool.h"
+
+static _Thread_local struct desc_pool_t *desc_pools;     // Pools registered by the calling thread
+static pthread_key_t desc_pool_key;
+static pthread_once_t desc_pool_once = PTHREAD_ONCE_INIT;
+
+static void desc_pool_key_create(void);
+
+/**
+ * pthread key destructor, frees every descriptor of the exiting thread's pools
+ */
+static void desc_pool_thread_exit(void *pools);
+
+// ============================================= global functions =============================================
+
+void desc_pool_register(struct desc_pool_t *pool) {
+    if (likely(pool->registered)) return;
+
+    pthread_once(&desc_pool_once, desc_pool_key_create);
+    pool->next = desc_pools;
+    pool->registered = true;
+    desc_pools = pool;
+    pthread_setspecific(desc_pool_key, desc_pools);
+}
+
+// ============================================= static functions implementation =============================================
+static void desc_pool_key_create(void) {
+    pthread_key_create(&desc_pool_key, desc_pool_thread_exit);
+}
+
+static void desc_pool_thread_exit(void *pools) {
+    for (struct desc_pool_t *pool = (struct desc_pool_t *) pools; pool; pool = pool->next) {
+        struct desc_pool_node_t *node;
+        while ((node = desc_pool_take(pool))) pool->destroy(node);
+        pool->registered = false;
+    }
+    desc_pools = NULL;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// Requested feature: pthread keys
+#define _POSIX_C_SOURCE   200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "helper.h"
+#include "macros.h"
+
+/**
+ * @brief Link of a transaction descriptor in its thread's pool, must be the first member of the descriptor.
+ */
+struct desc_pool_node_t {
+    struct desc_pool_node_t *next;
+};
+
+/**
+ * @brief Per-thread pool of unused transaction descriptors of one engine.
+ * Descriptors are reset rather than reallocated, so their logs keep their capacity across transactions
+ * and retries. Each engine keeps one _Thread_local pool; the pools a thread registered are freed when it exits.
+ * @param free_list  unused descriptors
+ * @param destroy    frees a descriptor and its logs
+ * @param next       next pool registered by the thread
+ * @param registered whether the pool is freed on thread exit
+ */
+struct desc_pool_t {
+    struct desc_pool_node_t *free_list;
+    void (*destroy)(struct desc_pool_node_t *node);
+    struct desc_pool_t *next;
+    bool registered;
+};
+
+/**
+ * @return Unused descriptor of the pool, NULL if it is empty
+ */
+static inline void *desc_pool_take(struct desc_pool_t *pool) {
+    struct desc_pool_node_t *node = pool->free_list;
+    if (likely(node)) pool->free_list = node->next;
+    return node;
+}
+
+/**
+ * Return a descriptor to the pool
+ */
+static inline void desc_pool_put(struct desc_pool_t *pool, void *descriptor) {
+    struct desc_pool_node_t *node = (struct desc_pool_node_t *) descriptor;
+    node->next = pool->free_list;
+    pool->free_list = node;
+}
+
+/**
+ * Have the descriptors of the calling thread's pool freed when the thread exits; called before the
+ * first descriptor of the pool is allocated
+ */
+void desc_pool_register(struct desc_pool_t *pool);
@@ -1,14 +1,243 @@
+// Requested features: MAP_ANONYMOUS, madvise
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "shared.h"
 
+/**
+ * Allocate zeroed memory, as an anonymous mapping when large enough (the kernel zero pages replace memset).
+ * Huge mappings are rounded to HUGE_PAGE_SIZE and use MAP_HUGETLB if the system has huge pages reserved,
+ * transparent huge pages (MADV_HUGEPAGE on a 2MB-aligned mapping) otherwise.
+ * @param huge   whether to back a mapping with huge pages
+ * @param mapped set to whether the memory is a mapping
+ * @param huged  set to whether the mapping is a huge one
+ * @return Memory aligned to align, NULL on failure
+ */
+static void *region_map(size_t size, size_t align, bool huge, bool *mapped, bool *huged);
+
+static void region_unmap(void *addr, size_t size, bool mapped, bool huge);
+
+/**
+ * @return Size of the mapping holding a segment of the given size, header and lock table included
+ */
+static size_t region_mapping_size(struct region_t *region, size_t size);
+
+/**
+ * @return log2 of the bytes per lock of the hashed table, from STRIPE_GRANULARITY_ENV
+ */
+static unsigned region_stripe_shift(size_t align);
+
+/**
+ * @return log2 of the bytes per lock of the lock tables, from WORDS_PER_LOCK_ENV (and at least a stripe)
+ */
+static unsigned region_lock_shift(size_t align, unsigned stripe_shift);
+
+/**
+ * @return log2 of the spacing of the stripes in the lock arrays, from STRIPE_PADDING_ENV
+ */
+static unsigned region_stripe_pad(void);
+
+/**
+ * @return Clock scheme named by CLOCK_ENV, GV1 if it is unset or unknown
+ */
+static enum clock_scheme_t region_clock_scheme(void);
+
+/**
+ * @return Pauses to wait for a held stripe, from LOCK_SPINS_ENV
+ */
+static unsigned region_lock_spins(void);
+
+/**
+ * @return log2 of the bytes per lock of the lock table of a segment: the region's, unless the table would
+ * have more locks than a stripe can index
+ */
+static unsigned region_lock_table_shift(struct region_t *region, size_t size);
+
+/**
+ * @return Size in bytes of the lock table of a segment
+ */
+static size_t region_lock_table_size(struct region_t *region, size_t size);
+
+/**
+ * Bind a lock table to the segment [start, start + size), reusing a table unbound long enough ago;
+ * alloc_lock must be held
+ * @param locks the zeroed (or previously used by the segment) locks
+ * @return Index of the table, 0 if there is none left (the segment then shares the hashed table)
+ */
+static uint8_t region_bind_lock_table(struct region_t *region, void *start, size_t size, v_lock_t *locks);
+
+/**
+ * Unbind the lock table of a segment about to be unmapped; alloc_lock must be held
+ */
+static void region_unbind_lock_table(struct region_t *region, uint8_t table);
+
+/**
+ * Bind the base segment to its lock table, unless the region does not use lock tables
+ */
+static void region_bind_start_locks(struct region_t *region);
+
+/**
+ * Rebuild the order of the bound lock tables searched by region_get_stripe; alloc_lock must be held
+ * (or the region not shared yet)
+ */
+static void region_sort_lock_tables(struct region_t *region);
+
+/**
+ * Give the segment an id if there is one left (segment-tagged addresses); alloc_lock must be held
+ * @return Whether the segment got an id, else its address stays plain
+ */
+static bool region_take_segment_id(struct region_t *region, struct segment_node_t *node);
+
+/**
+ * Give back the id of a segment about to be released; alloc_lock must be held
+ */
+static void region_put_segment_id(struct region_t *region, struct segment_node_t *node);
+
+/**
+ * @return Whether the region is set to use huge pages, from HUGE_PAGES_ENV
+ */
+static bool region_wants_huge_pages(void);
+
+/**
+ * @return Bytes of [addr, addr + size) backed by huge pages, according to /proc/self/smaps
+ */
+static size_t region_huge_bytes(void const *addr, size_t size);
+
+/**
+ * Zero a recycled segment: its pages are dropped if it is a mapping, faulting back in as zero pages
+ */
+static void region_zero_segment(struct region_t *region, struct segment_node_t *node);
+
+// ------- region pool -------
+
+static struct region_t *region_pool[REGION_POOL_SIZE];
+static size_t region_pool_count;
+static pthread_mutex_t region_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @return A pooled region of the given size and alignment, NULL if none
+ */
+static struct region_t *region_pool_take(size_t size, size_t align, bool huge_pages, unsigned lock_shift, unsigned stripe_pad, bool cells, bool locks);
+
+/**
+ * @return Whether the region was pooled
+ */
+static bool region_pool_put(struct region_t *region);
+
+/**
+ * Bring a destroyed region back to its state after region_create: free every segment, the stripe
+ * histories and the retired batches, and zero the base segment.
+ * The version clock and the lock versions are kept as they are: no lock is held and every lock
+ * version is at most the clock, which only keeps growing, so the next transactions see a consistent
+ * state without the O(VLOCK_NUM) reinitialization.
+ */
+static void region_clear(struct region_t *region);
+
+/**
+ * Free a region for good
+ */
+static void region_release(struct region_t *region);
+
+/**
+ * Start the background reclaimer if RECLAIMER_ENV asks for it
+ */
+static void region_start_reclaimer(struct region_t *region);
+
+/**
+ * Stop the background reclaimer, if running, leaving the remaining segments to region_destroy
+ */
+static void region_stop_reclaimer(struct region_t *region);
+
+/**
+ * Background reclaimer: retires and frees segments whenever signaled, retrying periodically while
+ * retired batches wait for the epoch to move
+ */
+static void *region_reclaimer(void *arg);
+
+/**
+ * Create a region, see region_create, region_create_colocated and region_create_unlocked
+ * @param cells whether the region is in co-located mode
+ * @param locks whether the region has versioned locks (hashed table and lock tables)
+ */
+static struct region_t *region_create_layout(size_t size, size_t align, bool cells, bool locks);
+
 struct region_t *region_create(size_t size, size_t align) {
-    struct region_t* region = (struct region_t*) malloc(sizeof(struct region_t));
+    return region_create_layout(size, align, false, true);
+}
+
+struct region_t *region_create_colocated(size_t size, size_t align) {
+    return region_create_layout(size, align, true, true);
+}
+
+struct region_t *region_create_unlocked(size_t size, size_t align) {
+    return region_create_layout(size, align, false, false);
+}
+
+static struct region_t *region_create_layout(size_t size, size_t align, bool cells, bool locks) {
+    bool huge_pages = region_wants_huge_pages();
+    unsigned stripe_shift = region_stripe_shift(align);
+    unsigned lock_shift = region_lock_shift(align, stripe_shift);
+    unsigned stripe_pad = region_stripe_pad();
+    struct region_t* region = region_pool_take(size, align, huge_pages, lock_shift, stripe_pad, cells, locks);
+    if (likely(region)) {
+        region->stripe_shift = stripe_shift;
+        region->clock_scheme = region_clock_scheme();
+        region->cm_policy = cm_policy_select();
+        region->lock_spins = region_lock_spins();
+        region->engine = &tl2_engine;
+        region->segment_locks = !cells && locks;
+        region_bind_start_locks(region);
+        if (unlikely(cells) && !region_enable_segment_ids(region)) {
+            region_destroy(region);
+            return NULL;
+        }
+        region_start_reclaimer(region);
+        return region;
+    }
+
+    // With huge pages, the region is mapped so that the lock table is on a huge page too; without locks,
+    // the pages of the table are never touched, hence never backed
+    bool self_mapped, self_huge;
+    region = (struct region_t*) region_map(sizeof(struct region_t), _Alignof(struct region_t), huge_pages && locks, &self_mapped, &self_huge);
     if (unlikely(!region)) {
         return NULL;
     }
+    region->huge_pages = huge_pages;
+    region->self_mapped = self_mapped;
+    region->self_huge = self_huge;
+    region->size = size;
+    region->lock_shift = lock_shift;
+    region->stripe_shift = stripe_shift;
+    region->stripe_pad = stripe_pad;
+
+    // Cells: the lock, padded so that the word keeps its alignment, then the word
+    region->cells = cells;
+    region->locks = locks;
+    region->align_shift = 0;
+    while (((size_t) 1 << region->align_shift) < align) region->align_shift++;
+    region->cell_header = align < sizeof(v_lock_t) ? sizeof(v_lock_t) : align;
+    region->cell_size = (region->cell_header + align + region->cell_header - 1) & ~(region->cell_header - 1);
+    region->start_size = region_storage_size(region, size);
 
     // We allocate the region memory buffer such that its words are correctly aligned.
-    if (unlikely(posix_memalign(&(region->start), align, size))) {
-        free(region);
+    size_t start_align = align < region->cell_header ? region->cell_header : align;
+    region->start = region_map(region->start_size, start_align, huge_pages, &region->start_mapped, &region->start_huge);
+    if (unlikely(!region->start)) {
+        region_unmap(region, sizeof(struct region_t), self_mapped, self_huge);
+        return NULL;
+    }
+
+    size_t start_locks_size = locks ? region_lock_table_size(region, size) : 0;
+    region->start_locks = NULL;
+    region->start_locks_mapped = false;
+    region->start_locks_huge = false;
+    if (locks) region->start_locks = region_map(start_locks_size, LOCK_TABLE_ALIGN, huge_pages, &region->start_locks_mapped, &region->start_locks_huge);
+    if (unlikely(locks && !region->start_locks)) {
+        region_unmap(region->start, region->start_size, region->start_mapped, region->start_huge);
+        region_unmap(region, sizeof(struct region_t), self_mapped, self_huge);
         return NULL;
     }
 
@@ -16,64 +245,86 @@ struct region_t *region_create(size_t size, size_t align) {
     region->to_free_count = 0;
     region->to_free_capacity = INITIAL_TO_FREE_CAPACITY;
     region->to_free_cum_size = 0;
-    region->to_free = malloc(region->to_free_capacity * sizeof(region->to_free_capacity));
+    region->retired = NULL;
+    region->retired_count = 0;
+    atomic_init(&region->reclaimed_count, 0);
+    atomic_init(&region->reclaimed_size, 0);
+    atomic_init(&region->recycled_total, 0);
+    atomic_init(&region->recycled_size, 0);
+    region->to_free = malloc(region->to_free_capacity * sizeof(*region->to_free));
     if (unlikely(!region->to_free)) {
-        free(region->start);
-        free(region);
+        region_unmap(region->start_locks, start_locks_size, region->start_locks_mapped, region->start_locks_huge);
+        region_unmap(region->start, region->start_size, region->start_mapped, region->start_huge);
+        region_unmap(region, sizeof(struct region_t), self_mapped, self_huge);
         return NULL;
     }
 
     // Initialize the locks
     if (unlikely(pthread_mutex_init(&region->alloc_lock, NULL) ||
-                pthread_mutex_init(&region->append_to_free_lock, NULL)) ||
-                pthread_rwlock_init(&region->free_lock, NULL)
+                pthread_mutex_init(&region->append_to_free_lock, NULL) ||
+                pthread_cond_init(&region->reclaim_cond, NULL) ||
+                !slab_init(&region->slab))
     ) {
         free(region->to_free);
-        free(region->start);
-        free(region);
+        region_unmap(region->start_locks, start_locks_size, region->start_locks_mapped, region->start_locks_huge);
+        region_unmap(region->start, region->start_size, region->start_mapped, region->start_huge);
+        region_unmap(region, sizeof(struct region_t), self_mapped, self_huge);
         return NULL;
     }
 
     // Init the global version lock
     global_clock_init(&region->version_clock);
+    region->clock_scheme = region_clock_scheme();
+    region->cm_policy = cm_policy_select();
+    region->lock_spins = region_lock_spins();
     
     // Init the memory locks
-    for (size_t i = 0; i < VLOCK_NUM; i++) {
+    for (size_t i = 0; locks && i < VLOCK_NUM; i++) {
         v_lock_init(&region->v_locks[i]);
     }
+
+    // Lock tables: the base segment's, the ones of the mappings are bound by region_alloc
+    for (size_t i = 0; i < LOCK_TABLES; i++) {
+        atomic_init(&region->lock_tables[i].start, 0);
+        atomic_init(&region->lock_tables[i].end, 0);
+        region->lock_tables[i].released = 0;
+    }
+    atomic_init(&region->lock_table_count, 0);
+    atomic_init(&region->lock_order_seq, 0);
+    atomic_init(&region->lock_order_count, 0);
+    region->segment_locks = !cells && locks;
+    region_bind_start_locks(region);
+
+    // Single-version with plain addresses until region_enable_history and region_enable_segment_ids
+    region->segment_entries = NULL;
+    region->free_segment_ids = NULL;
+    region->histories = NULL;
+    for (size_t i = 0; i < MV_SNAPSHOT_SLOTS; i++) {
+        atomic_init(&region->snapshots[i], MV_NO_SNAPSHOT);
+    }
     
-    memset(region->start, 0, size);
+    region->engine      = &tl2_engine;
     region->allocs      = NULL;
-    region->size        = size;
+    region->recycled_count = 0;
     region->align       = align;
+
+    if (unlikely(cells) && !region_enable_segment_ids(region)) {
+        region_release(region);
+        return NULL;
+    }
+    region_start_reclaimer(region);
     return region;
 }
 
 void region_destroy(struct region_t *region) {
-    // Free allocated segments
-    while (region->allocs) { 
-        segment_list tail = region->allocs->next;
-        free(region->allocs);
-        region->allocs = tail;
-    }
-    free(region->to_free);
-
-    // Cleanup locks
-    pthread_mutex_destroy(&region->alloc_lock);
-    pthread_mutex_destroy(&region->append_to_free_lock);
-    pthread_rwlock_destroy(&region->free_lock);
-
-    global_clock_cleanup(&region->version_clock);
-    for (size_t i = 0; i < VLOCK_NUM; i++) {
-        v_lock_cleanup(&region->v_locks[i]);
-    }
-    
-    // Free initial memory region
-    free(region->start);
-    free(region);
+    region_stop_reclaimer(region);
+    region_clear(region);
+    if (likely(region_pool_put(region))) return;
+    region_release(region);
 }
 
 void* region_start(struct region_t *region) {
+    if (region->segment_entries) return (void *) ((uintptr_t) SEGMENT_BASE_ID << SEGMENT_ID_SHIFT);
     return region->start;
 }
 
@@ -85,56 +336,211 @@ size_t region_align(struct region_t *region) {
     return region->align;
 }
 
-int region_update_version_clock(struct region_t *region) {
-    return global_clock_increment_and_fetch(&region->version_clock);
+version_t region_update_version_clock(struct region_t *region, bool *exclusive) {
+    return global_clock_next_version(&region->version_clock, region->clock_scheme, exclusive);
+}
+
+void region_observe_version(struct region_t *region, version_t version) {
+    // Not only for GV5 and GV6: a pooled region keeps the lock versions of its previous scheme
+    global_clock_advance(&region->version_clock, version);
 }
 
 struct segment_node_t *region_alloc(struct region_t *region, size_t size) {
+    struct segment_node_t* node;
+
+    // Small and medium segments: thread-local slab cache, no region lock
+    int cls = region->align <= SLAB_MAX_ALIGN ? slab_class(sizeof(struct segment_node_t) + size) : SLAB_NO_CLASS;
+    if (likely(cls != SLAB_NO_CLASS)) {
+        node = slab_alloc(&region->slab, cls);
+        if (unlikely(!node)) return NULL;
+        node->size = size;
+        node->to_free = false;
+        node->mapped = false;
+        node->huge = false;
+        node->lock_table = 0;
+        node->segment_id = 0;
+        node->slab_class = cls;
+        memset(node + 1, 0, size);
+        if (unlikely(region->segment_entries)) {
+            pthread_mutex_lock(&region->alloc_lock);
+            bool tagged = region_take_segment_id(region, node);
+            pthread_mutex_unlock(&region->alloc_lock);
+            // Co-located cells are only reachable through a segment-tagged address
+            if (unlikely(!tagged && region->cells)) {
+                slab_free(&region->slab, node, cls);
+                return NULL;
+            }
+        }
+        return node;
+    }
+
+    // Reuse a segment rolled back by an aborted transaction
+    if (unlikely(region->recycled_count > 0)) {
+        node = NULL;
+        pthread_mutex_lock(&region->alloc_lock);
+        for (size_t i = 0; i < region->recycled_count; i++) {
+            if (region->recycled[i]->size == size) {
+                node = region->recycled[i];
+                region->recycled[i] = region->recycled[--region->recycled_count];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&region->alloc_lock);
+        if (node) {
+            node->to_free = false;
+            region_zero_segment(region, node);
+            return node;
+        }
+    }
+
     size_t align = region->align;
     align = align < sizeof(struct segment_node_t*) ? sizeof(void*) : align;
 
-    struct segment_node_t* node;
-    if (unlikely(posix_memalign((void**)&node, align, sizeof(struct segment_node_t) + size) != 0)) // Allocation failed
-        return NULL;
+    // The header precedes the data, so a mapping (page-aligned) only fits alignments up to the header size
+    bool mapped = false;
+    bool huge = false;
+    if (likely(align <= sizeof(struct segment_node_t)) && sizeof(struct segment_node_t) + size >= MMAP_THRESHOLD) {
+        bool want_huge = region->huge_pages && sizeof(struct segment_node_t) + size >= HUGE_PAGE_SIZE;
+        node = region_map(region_mapping_size(region, size), align, want_huge, &mapped, &huge);
+        if (unlikely(!node)) return NULL;
+    } else {
+        if (unlikely(posix_memalign((void**)&node, align, sizeof(struct segment_node_t) + size) != 0)) // Allocation failed
+            return NULL;
+        memset(node + 1, 0, size);
+    }
 
     node->size = size;
+    node->to_free = false;
+    node->mapped = mapped;
+    node->huge = huge;
+    node->slab_class = SLAB_NO_CLASS;
     // Insert in the linked list
     pthread_mutex_lock(&region->alloc_lock);
+    node->lock_table = 0;
+    if (mapped && region->segment_locks) {
+        v_lock_t *locks = (v_lock_t *) ((char *) node + region_mapping_size(region, size) - region_lock_table_size(region, size));
+        node->lock_table = region_bind_lock_table(region, node + 1, size, locks);
+    }
+    node->segment_id = 0;
+    if (unlikely(region->segment_entries) && !region_take_segment_id(region, node) && region->cells) {
+        if (node->lock_table) region_unbind_lock_table(region, node->lock_table);
+        pthread_mutex_unlock(&region->alloc_lock);
+        if (mapped) region_unmap(node, region_mapping_size(region, size), true, huge);
+        else free(node);
+        return NULL;
+    }
     node->prev = NULL;
     node->next = region->allocs;
     if (unlikely(node->next)) node->next->prev = node;
     region->allocs = node;
     pthread_mutex_unlock(&region->alloc_lock);
+    return node;
+}
+
+struct segment_node_t *region_alloc_logged(struct region_t *region, struct alloc_log_t *log, size_t size) {
+    // Make room first, so that a logged segment can't fail to be recorded
+    if (unlikely(log->count == log->capacity)) {
+        size_t capacity = log->capacity ? log->capacity * GROW_FACTOR : INITIAL_CAPACITY;
+        struct segment_node_t **nodes = realloc(log->nodes, capacity * sizeof(struct segment_node_t *));
+        if (unlikely(!nodes)) return NULL;
+        log->nodes = nodes;
+        log->capacity = capacity;
+    }
 
+    struct segment_node_t *node = region_alloc(region, size);
+    if (likely(node)) log->nodes[log->count++] = node;
     return node;
 }
 
+void region_rollback_allocs(struct region_t *region, struct alloc_log_t *log) {
+    // Slab segments go back to the thread cache, the large ones are compacted at the front of the log
+    size_t large = 0;
+    for (size_t i = 0; i < log->count; i++) {
+        struct segment_node_t *node = log->nodes[i];
+        if (likely(node->slab_class != SLAB_NO_CLASS)) {
+            if (unlikely(node->segment_id)) {
+                pthread_mutex_lock(&region->alloc_lock);
+                region_put_segment_id(region, node);
+                pthread_mutex_unlock(&region->alloc_lock);
+            }
+            slab_free(&region->slab, node, node->slab_class);
+        } else {
+            log->nodes[large++] = node;
+        }
+    }
+
+    size_t kept = 0;
+    if (unlikely(large > 0)) {
+        pthread_mutex_lock(&region->alloc_lock);
+        while (kept < large && region->recycled_count < RECYCLED_SEGMENTS_MAX) {
+            region->recycled[region->recycled_count++] = log->nodes[kept++];
+        }
+        pthread_mutex_unlock(&region->alloc_lock);
+    }
+
+    // Recycle cache full: retire the others like freed segments
+    for (size_t i = kept; i < large; i++) {
+        void *data = (void *) ((uintptr_t) log->nodes[i] + sizeof(struct segment_node_t));
+        region_append_to_free(region, &data, 1);
+    }
+    log->count = 0;
+}
+
+void alloc_log_free(struct alloc_log_t *log) {
+    free(log->nodes);
+    log->nodes = NULL;
+    log->count = log->capacity = 0;
+}
+
+bool free_log_add(struct free_log_t *log, void *target) {
+    if (unlikely(log->count == log->capacity)) {
+        size_t capacity = log->capacity ? log->capacity * GROW_FACTOR : INITIAL_CAPACITY;
+        void **targets = realloc(log->targets, capacity * sizeof(void *));
+        if (unlikely(!targets)) return false;
+        log->targets = targets;
+        log->capacity = capacity;
+    }
+    log->targets[log->count++] = target;
+    return true;
+}
+
+void free_log_free(struct free_log_t *log) {
+    free(log->targets);
+    log->targets = NULL;
+    log->count = log->capacity = 0;
+}
+
+bool region_commit_logs(struct region_t *region, struct alloc_log_t *allocs, struct free_log_t *frees) {
+    allocs->count = 0;
+    if (likely(frees->count == 0)) return false;
+
+    region_append_to_free(region, frees->targets, frees->count);
+    frees->count = 0;
+    return region->to_free_count    >= SEGMENT_FREE_BATCH_SIZE ||         // If too many segments, free
+           region->to_free_cum_size >= SEGMENT_FREE_BATCH_CUM_SIZE;       // If segment free cumulated size is too big, free
+}
+
 bool region_append_to_free(struct region_t *region, void** txn_to_free, size_t txn_to_free_count) {
     // Append to_free list to the end of region->to_free list
     pthread_mutex_lock(&region->append_to_free_lock);
     // Increase size of to_free dynamic array if needed
     if (unlikely(region->to_free_count + txn_to_free_count > region->to_free_capacity)) {
-        region->to_free_capacity *= GROW_FACTOR;
-        region->to_free = realloc(region->to_free, region->to_free_capacity * sizeof(struct segment_node_t *));
-        if (unlikely(!region->to_free)) {
+        size_t capacity = region->to_free_capacity;
+        while (capacity < region->to_free_count + txn_to_free_count) capacity *= GROW_FACTOR;
+        struct segment_node_t **to_free = realloc(region->to_free, capacity * sizeof(struct segment_node_t *));
+        if (unlikely(!to_free)) {
             pthread_mutex_unlock(&region->append_to_free_lock);
             return false;
         }
+        region->to_free = to_free;
+        region->to_free_capacity = capacity;
     }
 
-    // Append the new to_free pointers
+    // Append the new to_free pointers, skipping segments already queued
     for (size_t i = 0; i < txn_to_free_count; i++) {
-        bool is_duplicate = false;
-        // Check if the memory region id already in the list
-        for (size_t j = 0; j < region->to_free_count; j++) {
-            struct segment_node_t* node = (struct segment_node_t*) ((uintptr_t) txn_to_free[i] - sizeof(struct segment_node_t));
-            if (unlikely(region->to_free[j] == node)) {     // TODO: test if likely or unlikely is better here
-                is_duplicate = true;
-                break; 
-            }
-        }
-        if (likely(!is_duplicate)) {    // TODO: test if likely or unlikely is better here, generally segment is scheduled to be freed multiple times
-            struct segment_node_t* node = (struct segment_node_t*) ((uintptr_t) txn_to_free[i] - sizeof(struct segment_node_t));
+        struct segment_node_t* node = (struct segment_node_t*) ((uintptr_t) region_segment_data(region, txn_to_free[i]) - sizeof(struct segment_node_t));
+        if (likely(!node->to_free)) {
+            node->to_free = true;
             region->to_free[region->to_free_count++] = node;
             region->to_free_cum_size += node->size;
         }
@@ -144,28 +550,654 @@ bool region_append_to_free(struct region_t *region, void** txn_to_free, size_t t
 }
 
 bool region_free(struct region_t *region) {
-    // Free all queued to-free memory regions
-    pthread_rwlock_wrlock(&region->free_lock);
-    for (size_t i = 0; i < region->to_free_count; i++) {
+    bool retired = true;
+    pthread_mutex_lock(&region->append_to_free_lock);
+    if (likely(region->to_free_count > 0)) {
+        struct free_batch_t *batch = malloc(sizeof(struct free_batch_t) + region->to_free_count * sizeof(struct segment_node_t *));
+        if (likely(batch)) {
+            memcpy(batch->nodes, region->to_free, region->to_free_count * sizeof(struct segment_node_t *));
+            batch->count = region->to_free_count;
+            batch->epoch = ebr_epoch();     // Every transaction that may still access the segments has announced at most this epoch
+            batch->next = region->retired;
+            region->retired = batch;
+            region->retired_count += batch->count;
+            region->to_free_count = 0;
+            region->to_free_cum_size = 0;
+        } else {
+            retired = false;
+        }
+    }
+    pthread_mutex_unlock(&region->append_to_free_lock);
+
+    // Two steps are needed for a batch retired now; they only succeed if no transaction is still running
+    ebr_try_advance();
+    unsigned long epoch = ebr_try_advance();
 
-        // remove from linked list
-        struct segment_node_t *node = region->to_free[i];
-        if (likely(node->prev)) node->prev->next = node->next;
-        else region->allocs = node->next;
-        if (likely(node->next)) node->next->prev = node->prev;
-        free(node);
+    // Detach the batches retired at epoch - 2 or earlier (the list is ordered, newest first)
+    struct free_batch_t *reclaimed = NULL;
+    pthread_mutex_lock(&region->append_to_free_lock);
+    for (struct free_batch_t **link = &region->retired; *link; link = &(*link)->next) {
+        if ((*link)->epoch + 2 <= epoch) {
+            reclaimed = *link;
+            *link = NULL;
+            break;
+        }
     }
+    for (struct free_batch_t *batch = reclaimed; batch; batch = batch->next) {
+        region->retired_count -= batch->count;
+    }
+    pthread_mutex_unlock(&region->append_to_free_lock);
 
-    // Set to_free count to 0 to avoid double frees
-    region->to_free_count = 0;
-    pthread_rwlock_unlock(&region->free_lock);
+    while (reclaimed) {
+        struct free_batch_t *next = reclaimed->next;
+
+        // Remove from the linked list (region_alloc inserts concurrently); mappings are recycled while there is room
+        size_t reclaimed_count = reclaimed->count, reclaimed_size = 0, recycled_size = 0;
+        pthread_mutex_lock(&region->alloc_lock);
+        for (size_t i = 0; i < reclaimed->count; i++) {
+            struct segment_node_t *node = reclaimed->nodes[i];
+            if (node->slab_class != SLAB_NO_CLASS) {
+                if (unlikely(node->segment_id)) region_put_segment_id(region, node);
+                continue;
+            }
+            if (node->mapped && !node->huge && region->recycled_count < RECYCLED_SEGMENTS_MAX) {
+                node->to_free = false;
+                region->recycled[region->recycled_count++] = node;
+                reclaimed->nodes[i] = NULL;
+                reclaimed_count--;
+                recycled_size += node->size;
+                continue;
+            }
+            if (likely(node->prev)) node->prev->next = node->next;
+            else region->allocs = node->next;
+            if (likely(node->next)) node->next->prev = node->prev;
+            if (node->lock_table) region_unbind_lock_table(region, node->lock_table);
+            if (unlikely(node->segment_id)) region_put_segment_id(region, node);
+        }
+        pthread_mutex_unlock(&region->alloc_lock);
+
+        for (size_t i = 0; i < reclaimed->count; i++) {
+            struct segment_node_t *node = reclaimed->nodes[i];
+            if (!node) continue;
+            reclaimed_size += node->size;
+            if (node->slab_class != SLAB_NO_CLASS) slab_free(&region->slab, node, node->slab_class);
+            else if (node->mapped) region_unmap(node, region_mapping_size(region, node->size), true, node->huge);
+            else free(node);
+        }
+        atomic_fetch_add_explicit(&region->reclaimed_count, reclaimed_count, memory_order_relaxed);
+        atomic_fetch_add_explicit(&region->reclaimed_size, reclaimed_size, memory_order_relaxed);
+        atomic_fetch_add_explicit(&region->recycled_total, reclaimed->count - reclaimed_count, memory_order_relaxed);
+        atomic_fetch_add_explicit(&region->recycled_size, recycled_size, memory_order_relaxed);
+        free(reclaimed);
+        reclaimed = next;
+    }
+    return retired;
+}
+
+void region_schedule_free(struct region_t *region) {
+    if (likely(!region->reclaimer_running)) {
+        region_free(region);
+        return;
+    }
+    pthread_mutex_lock(&region->append_to_free_lock);
+    pthread_cond_signal(&region->reclaim_cond);
+    pthread_mutex_unlock(&region->append_to_free_lock);
+}
+
+void region_free_stats(struct region_t *region, struct region_free_stats_t *stats) {
+    pthread_mutex_lock(&region->append_to_free_lock);
+    stats->pending_count = region->to_free_count;
+    stats->pending_size = region->to_free_cum_size;
+    stats->retired_count = region->retired_count;
+    pthread_mutex_unlock(&region->append_to_free_lock);
+    stats->reclaimed_count = atomic_load_explicit(&region->reclaimed_count, memory_order_relaxed);
+    stats->reclaimed_size = atomic_load_explicit(&region->reclaimed_size, memory_order_relaxed);
+    stats->recycled_count = atomic_load_explicit(&region->recycled_total, memory_order_relaxed);
+    stats->recycled_size = atomic_load_explicit(&region->recycled_size, memory_order_relaxed);
+}
+
+void region_huge_stats(struct region_t *region, struct region_huge_stats_t *stats) {
+    stats->mapped_size = 0;
+    stats->huge_size = 0;
+    if (region->self_mapped) {
+        stats->mapped_size += sizeof(struct region_t);
+        stats->huge_size += region_huge_bytes(region, sizeof(struct region_t));
+    }
+    if (region->start_mapped) {
+        stats->mapped_size += region->start_size;
+        stats->huge_size += region_huge_bytes(region->start, region->start_size);
+    }
+    if (region->start_locks_mapped) {
+        size_t start_locks_size = region_lock_table_size(region, region->size);
+        stats->mapped_size += start_locks_size;
+        stats->huge_size += region_huge_bytes(region->start_locks, start_locks_size);
+    }
+
+    pthread_mutex_lock(&region->alloc_lock);
+    for (struct segment_node_t *node = region->allocs; node; node = node->next) {
+        if (!node->mapped) continue;
+        stats->mapped_size += region_mapping_size(region, node->size);
+        stats->huge_size += region_huge_bytes(node, region_mapping_size(region, node->size));
+    }
+    pthread_mutex_unlock(&region->alloc_lock);
+
+    // A huge page may back more than the requested size
+    if (stats->huge_size > stats->mapped_size) stats->huge_size = stats->mapped_size;
+}
+
+bool region_enable_segment_ids(struct region_t *region) {
+    if (region->segment_entries) return true;
+
+    // calloc: entries are only read for ids in use, but the pages of unused ids are never touched
+    region->segment_entries = calloc(SEGMENT_IDS, sizeof(struct segment_entry_t));
+    region->free_segment_ids = malloc(SEGMENT_IDS * sizeof(uint16_t));
+    if (unlikely(!region->segment_entries || !region->free_segment_ids)) {
+        free(region->segment_entries);
+        free(region->free_segment_ids);
+        region->segment_entries = NULL;
+        region->free_segment_ids = NULL;
+        return false;
+    }
+    region->free_segment_id_count = 0;
+    region->next_segment_id = SEGMENT_BASE_ID + 1;
+
+    struct segment_entry_t *base = &region->segment_entries[SEGMENT_BASE_ID];
+    base->data = region->start;
+    base->size = region->start_size;
+    base->lock_table = region->segment_locks ? BASE_LOCK_TABLE : 0;
     return true;
 }
 
+void *region_segment_address(struct segment_node_t *node) {
+    if (node->segment_id) return (void *) ((uintptr_t) node->segment_id << SEGMENT_ID_SHIFT);
+    return (void *) (node + 1);
+}
+
+bool region_enable_history(struct region_t *region) {
+    // Histories are per stripe of the hashed table: every segment shares it in this mode
+    region->segment_locks = false;
+    atomic_store(&region->lock_tables[BASE_LOCK_TABLE].end, 0);
+    region_sort_lock_tables(region);
+
+    // Snapshots are registered against the clock: it must move with every commit
+    region->clock_scheme = CLOCK_GV1;
+
+    // calloc: no stripe has a history yet
+    region->histories = calloc(VLOCK_NUM, sizeof(*region->histories));
+    return region->histories != NULL;
+}
+
+struct mv_history_t *region_get_history(struct region_t *region, uintptr_t index) {
+    return atomic_load(&region->histories[index]);
+}
+
+struct mv_history_t *region_get_or_create_history(struct region_t *region, uintptr_t index) {
+    struct mv_history_t *history = atomic_load_explicit(&region->histories[index], memory_order_relaxed);
+    if (likely(history)) return history;
+
+    // Only the holder of the stripe lock creates its history, readers see it once published
+    history = mv_history_create(region->align);
+    if (likely(history)) atomic_store(&region->histories[index], history);
+    return history;
+}
+
+int region_register_snapshot(struct region_t *region, version_t *rv) {
+    // Start probing at a slot depending on the thread, so that threads rarely compete for a slot
+    static _Thread_local char slot_hint;
+    size_t start = ((uintptr_t) &slot_hint >> 6) % MV_SNAPSHOT_SLOTS;
+
+    for (size_t i = 0; i < MV_SNAPSHOT_SLOTS; i++) {
+        size_t slot = (start + i) % MV_SNAPSHOT_SLOTS;
+        version_t expected = MV_NO_SNAPSHOT;
+        if (atomic_load_explicit(&region->snapshots[slot], memory_order_relaxed) == MV_NO_SNAPSHOT &&
+            atomic_compare_exchange_strong(&region->snapshots[slot], &expected, *rv)) {
+            // A commit that sampled the slots before the registration got a version the snapshot can't miss
+            version_t clock;
+            while ((clock = global_clock_load(&region->version_clock)) != *rv) {
+                *rv = clock;
+                atomic_store(&region->snapshots[slot], clock);
+            }
+            return (int) slot;
+        }
+    }
+    return INVALID;
+}
+
+void region_unregister_snapshot(struct region_t *region, int slot) {
+    atomic_store(&region->snapshots[slot], MV_NO_SNAPSHOT);
+}
+
+version_t region_oldest_snapshot(struct region_t *region) {
+    version_t oldest = MV_NO_SNAPSHOT;
+    for (size_t i = 0; i < MV_SNAPSHOT_SLOTS; i++) {
+        version_t rv = atomic_load(&region->snapshots[i]);
+        if (rv < oldest) oldest = rv;
+    }
+    return oldest;
+}
+
 v_lock_t *region_get_memory_lock_from_index(struct region_t *region, uintptr_t index) {
-    return &region->v_locks[index];
+    if (unlikely(region->cells)) return (v_lock_t *) region_cell(region, index << region->align_shift);
+    uintptr_t table = index >> LOCK_TABLE_INDEX_BITS;
+    if (likely(table == 0)) return &region->v_locks[index];
+    return &region->lock_tables[table].locks[index & ((1UL << LOCK_TABLE_INDEX_BITS) - 1)];
 }
 
 v_lock_t *region_get_memory_lock_from_ptr(struct region_t *region, void const *addr) {
-    return &region->v_locks[get_memory_lock_index(addr)];
+    return region_get_memory_lock_from_index(region, region_get_stripe(region, addr));
+}
+
+// ============================================= static functions implementation =============================================
+static struct region_t *region_pool_take(size_t size, size_t align, bool huge_pages, unsigned lock_shift, unsigned stripe_pad, bool cells, bool locks) {
+    struct region_t *region = NULL;
+    pthread_mutex_lock(&region_pool_lock);
+    for (size_t i = 0; i < region_pool_count; i++) {
+        if (region_pool[i]->size == size && region_pool[i]->align == align && region_pool[i]->huge_pages == huge_pages &&
+            region_pool[i]->lock_shift == lock_shift && region_pool[i]->stripe_pad == stripe_pad &&
+            region_pool[i]->cells == cells && region_pool[i]->locks == locks) {
+            region = region_pool[i];
+            region_pool[i] = region_pool[--region_pool_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&region_pool_lock);
+    return region;
+}
+
+static bool region_pool_put(struct region_t *region) {
+    bool pooled = false;
+    pthread_mutex_lock(&region_pool_lock);
+    if (region_pool_count < REGION_POOL_SIZE) {
+        region_pool[region_pool_count++] = region;
+        pooled = true;
+    }
+    pthread_mutex_unlock(&region_pool_lock);
+    return pooled;
+}
+
+static void region_clear(struct region_t *region) {
+    // Free allocated segments
+    while (region->allocs) { 
+        segment_list tail = region->allocs->next;
+        if (region->allocs->mapped) region_unmap(region->allocs, region_mapping_size(region, region->allocs->size), true, region->allocs->huge);
+        else free(region->allocs);
+        region->allocs = tail;
+    }
+    region->recycled_count = 0;
+    slab_reset(&region->slab);
+
+    // No transaction runs anymore: every table of a mapping can be bound again right away
+    for (size_t i = BASE_LOCK_TABLE + 1; i < LOCK_TABLES; i++) {
+        atomic_store_explicit(&region->lock_tables[i].end, 0, memory_order_relaxed);
+        region->lock_tables[i].released = 0;
+    }
+    atomic_store_explicit(&region->lock_table_count, BASE_LOCK_TABLE + 1, memory_order_relaxed);
+    region_sort_lock_tables(region);
+
+    region->to_free_count = 0;
+    region->to_free_cum_size = 0;
+    while (region->retired) {
+        struct free_batch_t *next = region->retired->next;
+        free(region->retired);
+        region->retired = next;
+    }
+    region->retired_count = 0;
+    atomic_store(&region->reclaimed_count, 0);
+    atomic_store(&region->reclaimed_size, 0);
+    atomic_store(&region->recycled_total, 0);
+    atomic_store(&region->recycled_size, 0);
+
+    // Back to plain addresses
+    free(region->segment_entries);
+    free(region->free_segment_ids);
+    region->segment_entries = NULL;
+    region->free_segment_ids = NULL;
+
+    // Free stripe histories
+    if (region->histories) {
+        for (size_t i = 0; i < VLOCK_NUM; i++) {
+            free(atomic_load(&region->histories[i]));
+        }
+        free(region->histories);
+        region->histories = NULL;
+    }
+    for (size_t i = 0; i < MV_SNAPSHOT_SLOTS; i++) {
+        atomic_store(&region->snapshots[i], MV_NO_SNAPSHOT);
+    }
+
+    // The next engine may use the clock as a sequence lock (norec), which must then be even
+    if (global_clock_load(&region->version_clock) & 1) global_clock_increment_and_fetch(&region->version_clock);
+
+    // Zero the base segment; a mapping gets its physical pages back to the system until reused
+    size_t start_size = region->start_huge ? (region->start_size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1) : region->start_size;
+    if (!region->start_mapped || madvise(region->start, start_size, MADV_DONTNEED) != 0) memset(region->start, 0, region->start_size);
+}
+
+static void region_release(struct region_t *region) {
+    free(region->to_free);
+    slab_destroy(&region->slab);
+
+    // Cleanup locks
+    pthread_mutex_destroy(&region->alloc_lock);
+    pthread_mutex_destroy(&region->append_to_free_lock);
+    pthread_cond_destroy(&region->reclaim_cond);
+
+    global_clock_cleanup(&region->version_clock);
+    for (size_t i = 0; region->locks && i < VLOCK_NUM; i++) {
+        v_lock_cleanup(&region->v_locks[i]);
+    }
+    
+    // Free initial memory region
+    if (region->locks) region_unmap(region->start_locks, region_lock_table_size(region, region->size), region->start_locks_mapped, region->start_locks_huge);
+    region_unmap(region->start, region->start_size, region->start_mapped, region->start_huge);
+    region_unmap(region, sizeof(struct region_t), region->self_mapped, region->self_huge);
+}
+
+static void *region_map(size_t size, size_t align, bool huge, bool *mapped, bool *huged) {
+    void *addr;
+    *huged = false;
+    *mapped = size >= MMAP_THRESHOLD && align <= (size_t) sysconf(_SC_PAGESIZE);
+    if (!*mapped) {
+        if (unlikely(posix_memalign(&addr, align, size))) return NULL;
+        memset(addr, 0, size);
+        return addr;
+    }
+
+    if (unlikely(huge)) {
+        size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+        *huged = true;
+#ifdef MAP_HUGETLB
+        addr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) return addr;
+#endif
+        // Transparent huge pages only back 2MB-aligned ranges: over-map, then trim both ends
+        char *raw = mmap(NULL, huge_size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (unlikely(raw == MAP_FAILED)) return NULL;
+        char *aligned = (char *) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+        if (aligned > raw) munmap(raw, (size_t) (aligned - raw));
+        munmap(aligned + huge_size, (size_t) (raw + HUGE_PAGE_SIZE - aligned));
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, huge_size, MADV_HUGEPAGE);
+#endif
+        return aligned;
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+static void region_unmap(void *addr, size_t size, bool mapped, bool huge) {
+    if (!mapped) free(addr);
+    else if (huge) munmap(addr, (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1));
+    else munmap(addr, size);
+}
+
+static bool region_wants_huge_pages(void) {
+    char const *setting = getenv(HUGE_PAGES_ENV);
+    return setting && *setting && strcmp(setting, "0") != 0;
+}
+
+static size_t region_huge_bytes(void const *addr, size_t size) {
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (unlikely(!smaps)) return 0;
+
+    // Sum the huge-page counters of the mappings overlapping the range
+    uintptr_t begin = (uintptr_t) addr, end = begin + size;
+    bool overlaps = false;
+    size_t huge = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long from, to, kb;
+        if (sscanf(line, "%lx-%lx ", &from, &to) == 2) {
+            overlaps = from < end && to > begin;
+        } else if (overlaps && (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+                                sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+                                sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1)) {
+            huge += kb * 1024;
+        }
+    }
+    fclose(smaps);
+    return huge;
+}
+
+static size_t region_mapping_size(struct region_t *region, size_t size) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    if (!region->segment_locks) return (sizeof(struct segment_node_t) + size + page - 1) & ~(page - 1);
+    size_t locks = (sizeof(struct segment_node_t) + size + LOCK_TABLE_ALIGN - 1) & ~((size_t) LOCK_TABLE_ALIGN - 1);
+    return (locks + region_lock_table_size(region, size) + page - 1) & ~(page - 1);
+}
+
+static unsigned region_stripe_shift(size_t align) {
+    size_t granularity = align;
+    char const *setting = getenv(STRIPE_GRANULARITY_ENV);
+    if (unlikely(setting)) {
+        if (strcmp(setting, "line") == 0) granularity = LOCK_TABLE_ALIGN;
+        else if (strcmp(setting, "page") == 0) granularity = (size_t) sysconf(_SC_PAGESIZE);
+        else if (strcmp(setting, "word") != 0) {
+            long parsed = strtol(setting, NULL, 10);
+            if (parsed > 0) granularity = (size_t) parsed;
+            else LOG_WARNING("region_stripe_shift: invalid %s '%s', using words\n", STRIPE_GRANULARITY_ENV, setting);
+        }
+    }
+
+    // A stripe covers whole words
+    unsigned shift = 0;
+    while (((size_t) 1 << shift) < granularity || ((size_t) 1 << shift) < align) shift++;
+    return shift;
+}
+
+static unsigned region_lock_shift(size_t align, unsigned stripe_shift) {
+    size_t words = DEFAULT_WORDS_PER_LOCK;
+    char const *setting = getenv(WORDS_PER_LOCK_ENV);
+    if (unlikely(setting)) {
+        long parsed = strtol(setting, NULL, 10);
+        if (parsed > 0) words = (size_t) parsed;
+        else LOG_WARNING("region_lock_shift: invalid %s '%s', using %d\n", WORDS_PER_LOCK_ENV, setting, DEFAULT_WORDS_PER_LOCK);
+    }
+
+    unsigned shift = stripe_shift;
+    while (((size_t) 1 << shift) < align * words) shift++;
+    return shift;
+}
+
+static unsigned region_stripe_pad(void) {
+    char const *setting = getenv(STRIPE_PADDING_ENV);
+    return setting && *setting && strcmp(setting, "0") != 0 ? STRIPE_PAD_SHIFT : 0;
+}
+
+static enum clock_scheme_t region_clock_scheme(void) {
+    static char const *const names[] = { [CLOCK_GV1] = "gv1", [CLOCK_GV4] = "gv4", [CLOCK_GV5] = "gv5", [CLOCK_GV6] = "gv6" };
+
+    char const *setting = getenv(CLOCK_ENV);
+    if (likely(!setting)) return CLOCK_GV1;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(names[i], setting) == 0) return (enum clock_scheme_t) i;
+    }
+    LOG_WARNING("region_clock_scheme: unknown %s '%s', using gv1\n", CLOCK_ENV, setting);
+    return CLOCK_GV1;
+}
+
+static unsigned region_lock_spins(void) {
+    char const *setting = getenv(LOCK_SPINS_ENV);
+    if (likely(!setting)) {
+        // The holder of a lock can't release it while a single processor spins
+        return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? DEFAULT_LOCK_SPINS : 0;
+    }
+
+    char *end;
+    long parsed = strtol(setting, &end, 10);
+    if (parsed >= 0 && parsed <= UINT_MAX && end != setting) return (unsigned) parsed;
+    LOG_WARNING("region_lock_spins: invalid %s '%s', using %d\n", LOCK_SPINS_ENV, setting, DEFAULT_LOCK_SPINS);
+    return DEFAULT_LOCK_SPINS;
+}
+
+static unsigned region_lock_table_shift(struct region_t *region, size_t size) {
+    unsigned shift = region->lock_shift;
+    while ((((size - 1) >> shift) << region->stripe_pad) >= ((size_t) 1 << LOCK_TABLE_INDEX_BITS)) shift++;
+    return shift;
+}
+
+static size_t region_lock_table_size(struct region_t *region, size_t size) {
+    return ((((size - 1) >> region_lock_table_shift(region, size)) + 1) << region->stripe_pad) * sizeof(v_lock_t);
+}
+
+static uint8_t region_bind_lock_table(struct region_t *region, void *start, size_t size, v_lock_t *locks) {
+    // An unbound table may still be looked up by the transactions running when it was unbound
+    unsigned long epoch = ebr_epoch();
+    unsigned count = atomic_load_explicit(&region->lock_table_count, memory_order_relaxed);
+    unsigned index = BASE_LOCK_TABLE + 1;
+    while (index < count && (atomic_load_explicit(&region->lock_tables[index].end, memory_order_relaxed) != 0 ||
+                             region->lock_tables[index].released + 2 > epoch)) {
+        index++;
+    }
+    if (unlikely(index == LOCK_TABLES)) return 0;
+
+    struct lock_table_t *table = &region->lock_tables[index];
+    atomic_store_explicit(&table->start, (uintptr_t) start, memory_order_relaxed);
+    table->shift = region_lock_table_shift(region, size);
+    table->locks = locks;
+    atomic_store_explicit(&table->end, (uintptr_t) start + size, memory_order_release);
+    if (index == count) atomic_store_explicit(&region->lock_table_count, count + 1, memory_order_release);
+    region_sort_lock_tables(region);
+    return (uint8_t) index;
+}
+
+static void region_unbind_lock_table(struct region_t *region, uint8_t table) {
+    atomic_store_explicit(&region->lock_tables[table].end, 0, memory_order_release);
+    region->lock_tables[table].released = ebr_epoch();
+    region_sort_lock_tables(region);
+}
+
+static void region_bind_start_locks(struct region_t *region) {
+    if (!region->segment_locks) return;
+
+    struct lock_table_t *table = &region->lock_tables[BASE_LOCK_TABLE];
+    atomic_store_explicit(&table->start, (uintptr_t) region->start, memory_order_relaxed);
+    table->shift = region_lock_table_shift(region, region->size);
+    table->locks = region->start_locks;
+    atomic_store_explicit(&table->end, (uintptr_t) region->start + region->size, memory_order_release);
+
+    unsigned count = atomic_load_explicit(&region->lock_table_count, memory_order_relaxed);
+    if (count <= BASE_LOCK_TABLE) atomic_store_explicit(&region->lock_table_count, BASE_LOCK_TABLE + 1, memory_order_release);
+    region_sort_lock_tables(region);
+}
+
+static void region_sort_lock_tables(struct region_t *region) {
+    uint8_t order[LOCK_TABLES];
+    unsigned sorted = 0;
+    unsigned count = atomic_load_explicit(&region->lock_table_count, memory_order_relaxed);
+    for (unsigned i = BASE_LOCK_TABLE; i < count; i++) {
+        if (atomic_load_explicit(&region->lock_tables[i].end, memory_order_relaxed) == 0) continue;
+        // Insertion sort: at most LOCK_TABLES tables, rebuilt only when a mapping is bound or released
+        uintptr_t start = atomic_load_explicit(&region->lock_tables[i].start, memory_order_relaxed);
+        unsigned j = sorted++;
+        while (j > 0 && atomic_load_explicit(&region->lock_tables[order[j - 1]].start, memory_order_relaxed) > start) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = (uint8_t) i;
+    }
+
+    // Seqlock write: lookups running meanwhile retry
+    unsigned seq = atomic_load_explicit(&region->lock_order_seq, memory_order_relaxed);
+    atomic_store_explicit(&region->lock_order_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (unsigned i = 0; i < sorted; i++) atomic_store_explicit(&region->lock_order[i], order[i], memory_order_relaxed);
+    atomic_store_explicit(&region->lock_order_count, sorted, memory_order_relaxed);
+    atomic_store_explicit(&region->lock_order_seq, seq + 2, memory_order_release);
+}
+
+static bool region_take_segment_id(struct region_t *region, struct segment_node_t *node) {
+    size_t id;
+    if (region->free_segment_id_count > 0) id = region->free_segment_ids[--region->free_segment_id_count];
+    else if (region->next_segment_id < SEGMENT_IDS) id = region->next_segment_id++;
+    else return false;
+
+    struct segment_entry_t *entry = &region->segment_entries[id];
+    entry->data = (char *) (node + 1);
+    entry->size = node->size;
+    entry->lock_table = node->lock_table;
+    node->segment_id = (uint16_t) id;
+    return true;
+}
+
+static void region_put_segment_id(struct region_t *region, struct segment_node_t *node) {
+    region->free_segment_ids[region->free_segment_id_count++] = node->segment_id;
+    node->segment_id = 0;
+}
+
+static void region_zero_segment(struct region_t *region, struct segment_node_t *node) {
+    char *data = (char *) (node + 1);
+    if (!node->mapped || node->huge) {
+        memset(data, 0, node->size);
+        return;
+    }
+
+    // The first page also holds the header (and its allocs links): clear it, drop the others
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    char *pages = (char *) node + page;
+    char *end = (char *) node + region_mapping_size(region, node->size);
+    memset(data, 0, (size_t) (pages - data) < node->size ? (size_t) (pages - data) : node->size);
+    if (pages < end) madvise(pages, (size_t) (end - pages), MADV_DONTNEED);
+}
+
+static void region_start_reclaimer(struct region_t *region) {
+    region->reclaimer_running = false;
+    region->reclaimer_stop = false;
+
+    char const *setting = getenv(RECLAIMER_ENV);
+    if (likely(!setting || !*setting || strcmp(setting, "0") == 0)) return;
+
+    if (unlikely(pthread_create(&region->reclaimer, NULL, region_reclaimer, region))) {
+        LOG_WARNING("region_start_reclaimer: failed to start the reclaimer, committing transactions free segments.\n");
+        return;
+    }
+    region->reclaimer_running = true;
+}
+
+static void region_stop_reclaimer(struct region_t *region) {
+    if (!region->reclaimer_running) return;
+
+    pthread_mutex_lock(&region->append_to_free_lock);
+    region->reclaimer_stop = true;
+    pthread_cond_signal(&region->reclaim_cond);
+    pthread_mutex_unlock(&region->append_to_free_lock);
+
+    pthread_join(region->reclaimer, NULL);
+    region->reclaimer_running = false;
+
+    struct region_free_stats_t stats;
+    region_free_stats(region, &stats);
+    LOG_NOTE("region_stop_reclaimer: %lu segments (%lu bytes) reclaimed, %lu recycled, %lu pending and %lu retired left to region_destroy\n",
+        stats.reclaimed_count, stats.reclaimed_size, stats.recycled_count, stats.pending_count, stats.retired_count);
+}
+
+static void *region_reclaimer(void *arg) {
+    struct region_t *region = (struct region_t *) arg;
+
+    pthread_mutex_lock(&region->append_to_free_lock);
+    while (!region->reclaimer_stop) {
+        if (region->to_free_count == 0 && !region->retired) {
+            pthread_cond_wait(&region->reclaim_cond, &region->append_to_free_lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&region->append_to_free_lock);
+        region_free(region);
+        pthread_mutex_lock(&region->append_to_free_lock);
+
+        if (region->to_free_count == 0 && region->retired && !region->reclaimer_stop) {
+            // Batches wait for running transactions to end: retry later, or as soon as there is more to free
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += RECLAIMER_RETRY_NS;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&region->reclaim_cond, &region->append_to_free_lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&region->append_to_free_lock);
+    return NULL;
 }
@@ -8,7 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cm.h"
+#include "ebr.h"
+#include "engine.h"
 #include "helper.h"
+#include "mv.h"
+#include "slab.h"
 #include "v_lock.h"
 #include "tm.h"
 #include "macros.h"
@@ -21,34 +26,210 @@ struct segment_node_t {
     struct segment_node_t* next;
 
     size_t size;
+    int8_t slab_class;  // Size class of a segment served by the region slab (not in allocs), SLAB_NO_CLASS otherwise
+    bool to_free;   // Already queued in region->to_free (set under append_to_free_lock)
+    bool mapped;    // Anonymous mapping (zero pages from the kernel), released with munmap
+    bool huge;      // Mapping backed by 2MB pages, its size is rounded to HUGE_PAGE_SIZE
+    uint8_t lock_table; // Lock table of a mapping (stored after its data), 0 if it shares the hashed table
+    uint16_t segment_id;    // Id tagging the addresses of the segment, 0 if they are plain pointers
 };
 typedef struct segment_node_t* segment_list;
 
+/**
+ * @brief Segments allocated by a transaction, released if it aborts.
+ */
+struct alloc_log_t {
+    struct segment_node_t **nodes;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * @brief Segments freed by a transaction, handed to the region once it committed.
+ */
+struct free_log_t {
+    void **targets;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * @brief Segments freed by committed transactions, waiting until no transaction can access them.
+ * @param epoch global epoch when the batch was retired
+ * @param next  previously retired (older) batch
+ */
+struct free_batch_t {
+    unsigned long epoch;
+    struct free_batch_t *next;
+    size_t count;
+    struct segment_node_t *nodes[];
+};
+
+/**
+ * @brief Lock table of one segment: the base segment or a mapping, whose words [start, end) are covered
+ * by 2^shift bytes per lock, so that no other segment collides on its locks.
+ * A table is unbound (end is 0) when its segment is unmapped, and only bound again once every transaction
+ * that may have looked it up has ended, so that lookups never see a mix of two bindings.
+ * @param released epoch when the table was unbound
+ */
+struct lock_table_t {
+    _Atomic uintptr_t start;
+    _Atomic uintptr_t end;
+    unsigned shift;
+    v_lock_t *locks;
+    unsigned long released;
+};
+
+/**
+ * @brief Directory entry of a segment id (segment-tagged addresses).
+ * An id is only given back once its segment is released, so the transactions holding a tagged address
+ * always see the entry of its segment.
+ * @param data       start of the segment
+ * @param lock_table lock table of the segment, 0 if it shares the hashed table
+ */
+struct segment_entry_t {
+    char *data;
+    size_t size;
+    uint8_t lock_table;
+};
+
 // ============ Shared region ============ 
 /**
  * @brief List of shared memory segments
  */
 struct region_t {
-    pthread_rwlock_t free_lock;             // Lock to size in write mode to free, in read mode for any active transaction
-    pthread_mutex_t append_to_free_lock;    // Lock to seize to append region to free
+    struct engine_t const *engine;          // Must come first, see engine_of
+    pthread_mutex_t append_to_free_lock;    // Lock to seize to append region to free, or to retire or reclaim a batch
     pthread_mutex_t alloc_lock;             // Lock to seize when allocating new memory block
     v_lock_t v_locks[VLOCK_NUM];            // Lock to acquire when writing to corresponding word in memory
-    global_clock_t version_clock;           // Global version lock
+    struct lock_table_t lock_tables[LOCK_TABLES];   // Per-segment lock tables (0 is unused, see v_locks)
+    atomic_uint lock_table_count;   // Tables at this index and above were never bound
+    atomic_uint lock_order_seq;     // Odd while lock_order changes (under alloc_lock)
+    atomic_uint lock_order_count;
+    _Atomic uint8_t lock_order[LOCK_TABLES];    // Bound tables by increasing start, binary searched by region_get_stripe
+    unsigned lock_shift;            // log2 of the bytes covered by a lock in the lock tables
+    unsigned stripe_shift;          // log2 of the bytes covered by a lock in the hashed table (STRIPE_GRANULARITY_ENV)
+    unsigned stripe_pad;            // Stripes are spaced by 2^stripe_pad locks (STRIPE_PADDING_ENV)
+    bool segment_locks;             // Whether segments get their own lock table (not in multi-version mode)
+
+    bool locks;                     // Whether v_locks and the lock tables are in use (not with norec, see region_create_unlocked)
+
+    // Co-located mode: every word of every segment is stored in a cell, after its own lock
+    bool cells;
+    unsigned align_shift;           // log2 of align
+    size_t cell_header;             // Offset of the word in its cell (the lock, padded to the alignment)
+    size_t cell_size;
+    enum clock_scheme_t clock_scheme;       // CLOCK_ENV, always GV1 in multi-version mode
+    enum cm_policy_t cm_policy;             // CM_ENV
+    unsigned lock_spins;                    // Pauses a transaction waits for a held stripe (LOCK_SPINS_ENV)
+
+    // Written by every commit: alone on its cache line, so that it does not invalidate the fields around it
+    _Alignas(CLOCK_CACHE_LINE) global_clock_t version_clock;  // Global version lock
+
+    // Multi-version mode only (histories is NULL otherwise)
+    _Alignas(CLOCK_CACHE_LINE) _Atomic(struct mv_history_t *) *histories;  // Version history of each stripe, created on first commit to it
+    _Atomic version_t snapshots[MV_SNAPSHOT_SLOTS];    // Read versions of active read-only transactions, MV_NO_SNAPSHOT if free
     
     void* start;
     size_t size;
     size_t align;
+    size_t start_size;          // Bytes of the base segment: size, or its cells in co-located mode
+    bool start_mapped;          // Base segment is an anonymous mapping
+    bool start_huge;            // Base segment is backed by 2MB pages
+    v_lock_t *start_locks;      // Lock table of the base segment
+
+    // Segment-tagged addresses only (segment_entries is NULL otherwise), see region_enable_segment_ids
+    struct segment_entry_t *segment_entries;    // SEGMENT_IDS entries, indexed by id
+    uint16_t *free_segment_ids;     // Ids given back, reused first (under alloc_lock)
+    size_t free_segment_id_count;
+    size_t next_segment_id;         // Ids from this one on were never used
+    bool start_locks_mapped;
+    bool start_locks_huge;
+
+    // Huge pages (HUGE_PAGES_ENV): the region itself, hence its lock table, is then a mapping too
+    bool huge_pages;
+    bool self_mapped;
+    bool self_huge;
     
-    segment_list allocs;
+    segment_list allocs;        // Segments too large for the slab
+    struct slab_t slab;         // Small and medium segments
+    struct segment_node_t *recycled[RECYCLED_SEGMENTS_MAX];    // Segments of aborted transactions, still in allocs
+    size_t recycled_count;
 
     struct segment_node_t **to_free;
     size_t to_free_capacity;
     size_t to_free_count;       // Number of segments to free
     size_t to_free_cum_size;    // Cumulative size of segments to free
+    struct free_batch_t *retired;   // Retired batches, newest first
+    size_t retired_count;           // Number of segments in retired batches
+
+    // Background reclaimer (segments are freed by the committing transactions if it is not running)
+    pthread_t reclaimer;
+    pthread_cond_t reclaim_cond;    // Signaled, under append_to_free_lock, when there is work or on stop
+    bool reclaimer_running;
+    bool reclaimer_stop;
+    atomic_size_t reclaimed_count;  // Number of segments freed so far
+    atomic_size_t reclaimed_size;   // Cumulative size of the segments freed so far
+    atomic_size_t recycled_total;   // Number of freed mappings kept in recycled instead, so far
+    atomic_size_t recycled_size;    // Cumulative size of those mappings
+};
+
+/**
+ * @brief Deferred-free backlog and throughput of a region.
+ * @param pending_count   segments freed by committed transactions, not retired yet
+ * @param pending_size    cumulative size of the pending segments
+ * @param retired_count   segments retired, waiting for the running transactions to end
+ * @param reclaimed_count segments returned to the system (or to the slab) so far
+ * @param reclaimed_size  cumulative size of the reclaimed segments
+ * @param recycled_count  freed mappings kept for reuse by region_alloc instead, so far
+ * @param recycled_size   cumulative size of the recycled mappings
+ */
+struct region_free_stats_t {
+    size_t pending_count;
+    size_t pending_size;
+    size_t retired_count;
+    size_t reclaimed_count;
+    size_t reclaimed_size;
+    size_t recycled_count;
+    size_t recycled_size;
 };
 
+/**
+ * @brief Huge-page coverage of a region's mappings (base segment, lock table and large segments).
+ * @param mapped_size cumulative size of the mappings
+ * @param huge_size   part of it actually backed by huge pages (explicit or transparent)
+ */
+struct region_huge_stats_t {
+    size_t mapped_size;
+    size_t huge_size;
+};
+
+/**
+ * Create a region, reusing a pooled one of the same size, alignment, huge page and lock table settings if any
+ * @return Region using the TL2 engine, NULL on failure
+ */
 struct region_t *region_create(size_t size, size_t align);
 
+/**
+ * Create a region in co-located mode: each word is stored in a cell right after its versioned lock, so
+ * that a read touches one cache line. The addresses are segment-tagged (see region_enable_segment_ids),
+ * their offsets counting words rather than cells; every stripe is a single word.
+ * @return Region using the TL2 engine, NULL on failure
+ */
+struct region_t *region_create_colocated(size_t size, size_t align);
+
+/**
+ * Create a region without versioned locks, for engines validating by value: neither the base segment nor
+ * the mappings get a lock table, and the pages of v_locks are never touched. region_get_stripe,
+ * region_get_memory_lock_from_index and region_get_memory_lock_from_ptr must not be called on it.
+ * @return Region using the TL2 engine, NULL on failure
+ */
+struct region_t *region_create_unlocked(size_t size, size_t align);
+
+/**
+ * Destroy a region: its segments are freed, then the region itself (lock table, base segment, locks)
+ * is kept in the process-wide pool if there is room
+ */
 void region_destroy(struct region_t *);
 
 void* region_start(struct region_t *);
@@ -57,15 +238,227 @@ size_t region_size(struct region_t *);
 
 size_t region_align(struct region_t *);
 
-int region_update_version_clock(struct region_t *);
+/**
+ * Get the write version of a commit from the version clock, according to the clock scheme of the region
+ * @param exclusive set to whether no other commit can get the same version (may be NULL): only then does
+ * wv == rv + 1 prove that nothing was committed since the snapshot
+ * @return Write version
+ */
+version_t region_update_version_clock(struct region_t *, bool *exclusive);
 
+/**
+ * Let the version clock catch up with a lock version a transaction saw beyond its snapshot (GV5, GV6 or a
+ * pooled region), so that the snapshot can be extended to it, or the retry starts from it
+ */
+void region_observe_version(struct region_t *, version_t version);
+
+/**
+ * Allocate a zeroed segment: small and medium ones from the slab, large ones as anonymous mappings, reusing
+ * a recycled one of the same size if any (whose pages are then dropped rather than cleared).
+ * @return Segment node, NULL on failure
+ */
 struct segment_node_t *region_alloc(struct region_t *, size_t size);
 
+/**
+ * Allocate a segment (see region_alloc) and record it in the transaction's allocation log
+ * @return Segment node, NULL on failure
+ */
+struct segment_node_t *region_alloc_logged(struct region_t *, struct alloc_log_t *log, size_t size);
+
+/**
+ * Undo the allocations of an aborted transaction: the segments are kept for reuse by region_alloc,
+ * or retired like freed segments once the recycle cache is full. Empties the log.
+ */
+void region_rollback_allocs(struct region_t *, struct alloc_log_t *log);
+
+/**
+ * Free the allocation log array
+ */
+void alloc_log_free(struct alloc_log_t *log);
+
+/**
+ * Record that a transaction frees the segment at target
+ * @return Whether the operation was a success
+ */
+bool free_log_add(struct free_log_t *log, void *target);
+
+/**
+ * Free the free log array
+ */
+void free_log_free(struct free_log_t *log);
+
+/**
+ * Make the allocations and frees of a committed transaction permanent: its segments stay allocated and
+ * the ones it freed are queued. Empties both logs.
+ * @return Whether the queue makes a batch: call region_schedule_free once the transaction left its epoch
+ */
+bool region_commit_logs(struct region_t *, struct alloc_log_t *allocs, struct free_log_t *frees);
+
+/**
+ * Queue segments freed by a committed transaction. A segment already queued is skipped (to_free marker).
+ * @return Whether the operation was a success
+ */
 bool region_append_to_free(struct region_t *, void** txn_to_free, size_t txn_to_free_count);
 
+/**
+ * Retire the segments to free as a batch, then release the batches no running transaction can access anymore.
+ * Transactions announce themselves with ebr_enter/ebr_leave instead of locking the region, so this never
+ * blocks them: batches are released once the global epoch moved two steps past their retirement.
+ * @return Whether the pending segments could be retired
+ */
 bool region_free(struct region_t *);
 
-uintptr_t get_memory_lock_index(void const *addr);
+/**
+ * Free the pending segments once a batch is complete: wakes the background reclaimer if the region has one,
+ * calls region_free otherwise
+ */
+void region_schedule_free(struct region_t *);
+
+/**
+ * Sample the deferred-free backlog and throughput of the region
+ */
+void region_free_stats(struct region_t *, struct region_free_stats_t *stats);
+
+/**
+ * Measure the huge-page coverage the region achieved, e.g. to report it once the region is populated
+ * (reads /proc/self/smaps, not meant for hot paths: nothing calls it on its own)
+ */
+void region_huge_stats(struct region_t *, struct region_huge_stats_t *stats);
+
+/**
+ * @return Cell of the word at the segment-tagged address addr (co-located mode)
+ */
+static inline char *region_cell(struct region_t *region, uintptr_t addr) {
+    char *data = region->segment_entries[addr >> SEGMENT_ID_SHIFT].data;
+    return data + ((addr & (((uintptr_t) 1 << SEGMENT_ID_SHIFT) - 1)) >> region->align_shift) * region->cell_size;
+}
+
+/**
+ * @return Actual address of the word at addr, which may be segment-tagged
+ */
+static inline void *region_resolve(struct region_t *region, void const *addr) {
+    uintptr_t word = (uintptr_t) addr;
+    uintptr_t id = word >> SEGMENT_ID_SHIFT;
+    if (likely(id == 0)) return (void *) addr;
+    if (unlikely(region->cells)) return region_cell(region, word) + region->cell_header;
+    return region->segment_entries[id].data + (word & (((uintptr_t) 1 << SEGMENT_ID_SHIFT) - 1));
+}
+
+/**
+ * @return Actual start of the segment whose (possibly segment-tagged) start address is addr
+ */
+static inline void *region_segment_data(struct region_t *region, void const *addr) {
+    uintptr_t id = (uintptr_t) addr >> SEGMENT_ID_SHIFT;
+    if (likely(id == 0)) return (void *) addr;
+    return region->segment_entries[id].data;
+}
+
+/**
+ * @return Bytes needed to store a segment of size bytes (its cells in co-located mode)
+ */
+static inline size_t region_storage_size(struct region_t *region, size_t size) {
+    if (likely(!region->cells)) return size;
+    return (size >> region->align_shift) * region->cell_size;
+}
+
+/**
+ * @return Stripe of the word at addr in the hashed table
+ */
+static inline stripe_t region_hash_stripe(struct region_t *region, void const *addr) {
+    void const *granule = (void const *) ((uintptr_t) addr >> region->stripe_shift);
+    return (stripe_t) set_hash(granule, VLOCK_NUM >> region->stripe_pad) << region->stripe_pad;
+}
+
+/**
+ * @return Stripe of the word at addr: a lock in the table of its segment, or in the hashed table.
+ * Consecutive words covered by the same lock have the same stripe.
+ */
+static inline stripe_t region_get_stripe(struct region_t *region, void const *addr) {
+    uintptr_t word = (uintptr_t) addr;
+    uintptr_t id = word >> SEGMENT_ID_SHIFT;
+    if (id != 0) {
+        // Co-located mode: the lock of each word is in its cell, the stripe is the word itself
+        if (unlikely(region->cells)) return (stripe_t) word >> region->align_shift;
+
+        // Tagged address: the segment is known without searching
+        unsigned table = region->segment_entries[id].lock_table;
+        if (unlikely(!table)) return region_hash_stripe(region, addr);
+        uintptr_t offset = word & (((uintptr_t) 1 << SEGMENT_ID_SHIFT) - 1);
+        return (stripe_t) (table << LOCK_TABLE_INDEX_BITS) | (stripe_t) ((offset >> region->lock_tables[table].shift) << region->stripe_pad);
+    }
+
+    // Plain address: the last table starting at or before it is the only one that can cover it
+    unsigned seq, found;
+    do {
+        seq = atomic_load_explicit(&region->lock_order_seq, memory_order_acquire);
+        unsigned low = 0, high = atomic_load_explicit(&region->lock_order_count, memory_order_relaxed);
+        while (low < high) {
+            unsigned mid = (low + high) / 2;
+            unsigned i = atomic_load_explicit(&region->lock_order[mid], memory_order_relaxed);
+            if (word < atomic_load_explicit(&region->lock_tables[i].start, memory_order_relaxed)) high = mid;
+            else low = mid + 1;
+        }
+        found = low > 0 ? atomic_load_explicit(&region->lock_order[low - 1], memory_order_relaxed) : 0;
+        atomic_thread_fence(memory_order_acquire);
+    } while (unlikely((seq & 1) || seq != atomic_load_explicit(&region->lock_order_seq, memory_order_relaxed)));
+
+    if (found) {
+        struct lock_table_t *table = &region->lock_tables[found];
+        uintptr_t start = atomic_load_explicit(&table->start, memory_order_relaxed);
+        if (word < atomic_load_explicit(&table->end, memory_order_acquire))
+            return (stripe_t) (found << LOCK_TABLE_INDEX_BITS) | (stripe_t) (((word - start) >> table->shift) << region->stripe_pad);
+    }
+    return region_hash_stripe(region, addr);
+}
+
+/**
+ * Switch the region to segment-tagged addresses: the base segment and the segments allocated from now
+ * on are addressed by their id in the high bits and the offset in the segment in the low ones (see
+ * SEGMENT_ID_SHIFT), so that their entry, hence their lock table, is found without searching.
+ * Segments allocated once every id is taken get plain addresses. Tagged addresses must go through
+ * region_resolve before being dereferenced.
+ * @return Whether the operation was a success
+ */
+bool region_enable_segment_ids(struct region_t *);
+
+/**
+ * @return Address of the first byte of the segment, tagged if it has an id
+ */
+void *region_segment_address(struct segment_node_t *node);
+
+/**
+ * Switch the region to multi-version mode: every commit keeps the overwritten words in
+ * per-stripe histories, so that read-only transactions can read past newer versions.
+ * @return Whether the operation was a success
+ */
+bool region_enable_history(struct region_t *);
+
+/**
+ * @return History of the stripe, NULL if there is none (yet)
+ */
+struct mv_history_t *region_get_history(struct region_t *, uintptr_t index);
+
+/**
+ * Get the history of the stripe, creating it if needed; the stripe lock must be held
+ * @return History of the stripe, NULL on failure
+ */
+struct mv_history_t *region_get_or_create_history(struct region_t *, uintptr_t index);
+
+/**
+ * Register the snapshot of a read-only transaction that has not read yet, so that the history it may need is
+ * kept by the following commits. The read version is resampled until the registration is visible to every
+ * commit of a newer version.
+ * @param rv read version of the transaction, updated to the registered one
+ * @return Registration slot, INVALID if all slots are taken
+ */
+int region_register_snapshot(struct region_t *, version_t *rv);
+
+void region_unregister_snapshot(struct region_t *, int slot);
+
+/**
+ * @return Oldest registered read version, MV_NO_SNAPSHOT if there is none
+ */
+version_t region_oldest_snapshot(struct region_t *);
 
 v_lock_t *region_get_memory_lock_from_index(struct region_t *region, uintptr_t index);
 
@@ -0,0 +1,252 @@
+/**
+ * @file   slab.c
+ *
+ * @section DESCRIPTION
+ *
+ * Size-class slab allocator for transactional segments: thread-local free lists per region,
+ * backed by per-class depots and by blocks owned by the region.
+**/
+
+#include "slab.h"
+
+/**
+ * @brief Chunks a thread cached for one slab.
+ * @param id    id of the slab, 0 if unused
+ * @param free  free chunks per class, linked through their first word
+ */
+struct slab_cache_t {
+    uint64_t id;
+    void *free[SLAB_CLASSES];
+    size_t count[SLAB_CLASSES];
+};
+
+static atomic_uint_fast64_t slab_next_id = 1;
+static _Thread_local struct slab_cache_t slab_caches[SLAB_THREAD_CACHES];
+
+// Registry of the live slabs by id, so that a cache can be handed back without touching a destroyed slab
+static struct slab_t *slab_live[SLAB_LIVE_BUCKETS];
+static pthread_mutex_t slab_live_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t slab_key;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void slab_key_create(void);
+
+/**
+ * pthread key destructor, flushes the exiting thread's caches
+ */
+static void slab_thread_exit(void *caches);
+
+/**
+ * Add the slab to the registry under its current id, or remove it
+ */
+static void slab_register(struct slab_t *slab);
+
+static void slab_unregister(struct slab_t *slab);
+
+/**
+ * @return Calling thread's cache for the slab. A cache held for another slab is flushed first.
+ */
+static struct slab_cache_t *slab_cache_of(struct slab_t *slab);
+
+/**
+ * Move every chunk of the cache to the depots of its slab if the slab is still live, then empty the cache
+ */
+static void slab_cache_flush(struct slab_cache_t *cache);
+
+/**
+ * Move up to SLAB_REFILL chunks from the depot of the class to the cache
+ * @return Whether a chunk was moved
+ */
+static bool slab_refill(struct slab_t *slab, struct slab_cache_t *cache, int cls);
+
+/**
+ * Carve a new block into chunks of the class, put in the cache
+ * @return Whether the operation was a success
+ */
+static bool slab_carve(struct slab_t *slab, struct slab_cache_t *cache, int cls);
+
+static inline size_t slab_chunk_size(int cls) {
+    return (size_t) 1 << (SLAB_MIN_CHUNK_SHIFT + cls);
+}
+
+// ============================================= global functions =============================================
+
+bool slab_init(struct slab_t *slab) {
+    slab->id = atomic_fetch_add(&slab_next_id, 1);
+    slab->blocks = NULL;
+    if (unlikely(pthread_mutex_init(&slab->block_lock, NULL))) return false;
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        if (unlikely(pthread_mutex_init(&slab->depots[cls].lock, NULL))) {
+            while (cls-- > 0) pthread_mutex_destroy(&slab->depots[cls].lock);
+            pthread_mutex_destroy(&slab->block_lock);
+            return false;
+        }
+        slab->depots[cls].head = NULL;
+        slab->depots[cls].count = 0;
+    }
+    slab_register(slab);
+    return true;
+}
+
+void slab_destroy(struct slab_t *slab) {
+    slab_reset(slab);
+    slab_unregister(slab);
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        pthread_mutex_destroy(&slab->depots[cls].lock);
+    }
+    pthread_mutex_destroy(&slab->block_lock);
+}
+
+void slab_reset(struct slab_t *slab) {
+    slab_unregister(slab);
+    while (slab->blocks) {
+        void *next = *(void **) slab->blocks;
+        free(slab->blocks);
+        slab->blocks = next;
+    }
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        slab->depots[cls].head = NULL;
+        slab->depots[cls].count = 0;
+    }
+    slab->id = atomic_fetch_add(&slab_next_id, 1);
+    slab_register(slab);
+}
+
+void *slab_alloc(struct slab_t *slab, int cls) {
+    struct slab_cache_t *cache = slab_cache_of(slab);
+    if (unlikely(!cache->free[cls] && !slab_refill(slab, cache, cls) && !slab_carve(slab, cache, cls))) return NULL;
+
+    void *chunk = cache->free[cls];
+    cache->free[cls] = *(void **) chunk;
+    cache->count[cls]--;
+    return chunk;
+}
+
+void slab_free(struct slab_t *slab, void *chunk, int cls) {
+    struct slab_cache_t *cache = slab_cache_of(slab);
+    *(void **) chunk = cache->free[cls];
+    cache->free[cls] = chunk;
+
+    if (unlikely(++cache->count[cls] > SLAB_CACHE_MAX)) {
+        // Hand half of the cache to the depot, for threads that allocate more than they free
+        void *first = cache->free[cls];
+        void *last = first;
+        for (size_t i = 1; i < SLAB_CACHE_MAX / 2; i++) last = *(void **) last;
+        cache->free[cls] = *(void **) last;
+        cache->count[cls] -= SLAB_CACHE_MAX / 2;
+
+        struct slab_depot_t *depot = &slab->depots[cls];
+        pthread_mutex_lock(&depot->lock);
+        *(void **) last = depot->head;
+        depot->head = first;
+        depot->count += SLAB_CACHE_MAX / 2;
+        pthread_mutex_unlock(&depot->lock);
+    }
+}
+
+// ============================================= static functions implementation =============================================
+static void slab_key_create(void) {
+    pthread_key_create(&slab_key, slab_thread_exit);
+}
+
+static void slab_thread_exit(void *caches) {
+    for (size_t i = 0; i < SLAB_THREAD_CACHES; i++) {
+        slab_cache_flush(&((struct slab_cache_t *) caches)[i]);
+    }
+}
+
+static void slab_register(struct slab_t *slab) {
+    struct slab_t **bucket = &slab_live[slab->id % SLAB_LIVE_BUCKETS];
+    pthread_mutex_lock(&slab_live_lock);
+    slab->live_next = *bucket;
+    *bucket = slab;
+    pthread_mutex_unlock(&slab_live_lock);
+}
+
+static void slab_unregister(struct slab_t *slab) {
+    pthread_mutex_lock(&slab_live_lock);
+    for (struct slab_t **link = &slab_live[slab->id % SLAB_LIVE_BUCKETS]; *link; link = &(*link)->live_next) {
+        if (*link == slab) {
+            *link = slab->live_next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slab_live_lock);
+}
+
+static struct slab_cache_t *slab_cache_of(struct slab_t *slab) {
+    struct slab_cache_t *cache = &slab_caches[slab->id % SLAB_THREAD_CACHES];
+    if (unlikely(cache->id != slab->id)) {
+        if (cache->id) {
+            slab_cache_flush(cache);
+        } else {
+            // Flush the caches of the thread when it exits
+            pthread_once(&slab_once, slab_key_create);
+            pthread_setspecific(slab_key, slab_caches);
+        }
+        cache->id = slab->id;
+    }
+    return cache;
+}
+
+static void slab_cache_flush(struct slab_cache_t *cache) {
+    // The registry lock keeps the slab from being destroyed or reset while its depots are filled
+    pthread_mutex_lock(&slab_live_lock);
+    struct slab_t *slab = slab_live[cache->id % SLAB_LIVE_BUCKETS];
+    while (slab && slab->id != cache->id) slab = slab->live_next;
+    for (int cls = 0; slab && cls < SLAB_CLASSES; cls++) {
+        if (!cache->free[cls]) continue;
+        void *last = cache->free[cls];
+        while (*(void **) last) last = *(void **) last;
+
+        struct slab_depot_t *depot = &slab->depots[cls];
+        pthread_mutex_lock(&depot->lock);
+        *(void **) last = depot->head;
+        depot->head = cache->free[cls];
+        depot->count += cache->count[cls];
+        pthread_mutex_unlock(&depot->lock);
+    }
+    pthread_mutex_unlock(&slab_live_lock);
+    *cache = (struct slab_cache_t) { .id = 0 };
+}
+
+static bool slab_refill(struct slab_t *slab, struct slab_cache_t *cache, int cls) {
+    struct slab_depot_t *depot = &slab->depots[cls];
+    if (likely(!depot->head)) return false;    // Racy hint, checked again under the lock
+
+    pthread_mutex_lock(&depot->lock);
+    size_t moved = 0;
+    while (depot->head && moved < SLAB_REFILL) {
+        void *chunk = depot->head;
+        depot->head = *(void **) chunk;
+        *(void **) chunk = cache->free[cls];
+        cache->free[cls] = chunk;
+        moved++;
+    }
+    depot->count -= moved;
+    pthread_mutex_unlock(&depot->lock);
+
+    cache->count[cls] += moved;
+    return moved > 0;
+}
+
+static bool slab_carve(struct slab_t *slab, struct slab_cache_t *cache, int cls) {
+    size_t chunk_size = slab_chunk_size(cls);
+    char *block = aligned_alloc(slab_chunk_size(0), SLAB_BLOCK_SIZE);
+    if (unlikely(!block)) return false;
+
+    pthread_mutex_lock(&slab->block_lock);
+    *(void **) block = slab->blocks;
+    slab->blocks = block;
+    pthread_mutex_unlock(&slab->block_lock);
+
+    // The first smallest chunk holds the block link
+    for (size_t offset = slab_chunk_size(0); offset + chunk_size <= SLAB_BLOCK_SIZE; offset += chunk_size) {
+        void *chunk = block + offset;
+        *(void **) chunk = cache->free[cls];
+        cache->free[cls] = chunk;
+        cache->count[cls]++;
+    }
+    return true;
+}
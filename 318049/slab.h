@@ -0,0 +1,78 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "helper.h"
+#include "macros.h"
+
+/**
+ * @brief Shared free list of one size class, filled by threads whose cache overflows.
+ * Chunks are linked through their first word.
+ */
+struct slab_depot_t {
+    pthread_mutex_t lock;
+    void *head;
+    size_t count;
+};
+
+/**
+ * @brief Size-class allocator of one region.
+ * Chunks are carved from blocks owned by the slab and served from per-thread caches, so that the
+ * common allocation and free only touch thread-local state. The blocks are only freed with the slab.
+ * A cache a thread gives up (evicted by another slab, or on thread exit) goes back to the depots if
+ * its slab is still registered under the same id; chunks cached for a destroyed slab are dropped.
+ * @param id         unique among all slabs ever created, identifies the slab in thread caches
+ * @param live_next  next slab of the same registry bucket
+ * @param blocks     carved blocks, linked through their first word
+ * @param block_lock protects blocks
+ * @param depots     chunks handed back by threads, per class
+ */
+struct slab_t {
+    uint64_t id;
+    struct slab_t *live_next;
+    void *blocks;
+    pthread_mutex_t block_lock;
+    struct slab_depot_t depots[SLAB_CLASSES];
+};
+
+/**
+ * Initialize an empty slab
+ * @return Whether the operation was a success
+ */
+bool slab_init(struct slab_t *slab);
+
+/**
+ * Free every block of the slab, including the chunks still in use
+ */
+void slab_destroy(struct slab_t *slab);
+
+/**
+ * Free every block of the slab and give it a new id, so that thread caches drop their chunks
+ * (the slab must not be used meanwhile)
+ */
+void slab_reset(struct slab_t *slab);
+
+/**
+ * @param chunk_size size of the chunk, header included
+ * @return Class of the smallest chunks that fit, SLAB_NO_CLASS if too large
+ */
+static inline int slab_class(size_t chunk_size) {
+    if (unlikely(chunk_size > ((size_t) 1 << (SLAB_MIN_CHUNK_SHIFT + SLAB_CLASSES - 1)))) return SLAB_NO_CLASS;
+    if (chunk_size <= ((size_t) 1 << SLAB_MIN_CHUNK_SHIFT)) return 0;
+    return (int) (sizeof(unsigned long) * 8 - __builtin_clzl(chunk_size - 1)) - SLAB_MIN_CHUNK_SHIFT;
+}
+
+/**
+ * Allocate a chunk of the class, aligned to 64 bytes
+ * @return Chunk, NULL on failure
+ */
+void *slab_alloc(struct slab_t *slab, int cls);
+
+/**
+ * Give a chunk of the class back to the calling thread's cache
+ */
+void slab_free(struct slab_t *slab, void *chunk, int cls);
@@ -0,0 +1,205 @@
+/**
+ * @file   tl2.c
+ *
+ * @section DESCRIPTION
+ *
+ * TL2 engine: single-version transactions over a table of versioned locks (txn.c, shared.c).
+**/
+
+// Requested features
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE   200809L
+#ifdef __STDC_NO_ATOMICS__
+    #error Current C11 compiler does not support atomic operations
+#endif
+
+// Internal headers
+#include <tm.h>
+
+#include "engine.h"
+#include "helper.h"
+#include "macros.h"
+#include "v_lock.h"
+#include "txn.h"
+#include "shared.h"
+
+/**
+ * Switch the region to segment-tagged addresses if SEGMENT_IDS_ENV asks for it
+ * @return Whether the operation was a success
+ */
+static bool tl2_enable_segment_ids(struct region_t *region) {
+    char const *setting = getenv(SEGMENT_IDS_ENV);
+    if (likely(!setting || !*setting || strcmp(setting, "0") == 0)) return true;
+    return region_enable_segment_ids(region);
+}
+
+/**
+ * @return Whether COLOCATED_ENV asks for regions in co-located mode
+ */
+static bool tl2_colocated(void) {
+    char const *setting = getenv(COLOCATED_ENV);
+    return setting && *setting && strcmp(setting, "0") != 0;
+}
+
+static shared_t tl2_create(size_t size, size_t align) {
+    LOG_LOG("tl2_create: creating new transactional machine.\n");
+    
+    struct region_t *region = tl2_colocated() ? region_create_colocated(size, align) : region_create(size, align);
+    // If shared memory region allocation failed, return invalid_shared
+    if (unlikely(!region)) {
+        LOG_WARNING("tl2_create: transactional machine shared memory region creation failed.\n");
+        return invalid_shared;
+    } 
+    if (unlikely(!tl2_enable_segment_ids(region))) {
+        LOG_WARNING("tl2_create: failed to allocate the segment directory.\n");
+        region_destroy(region);
+        return invalid_shared;
+    }
+    LOG_LOG("tl2_create: transactional machine shared memory region %p of size %lu and alignement %lu was successfully created.\n", (shared_t) region, size, align);
+    
+    return (shared_t) region;
+}
+
+static shared_t tl2_mv_create(size_t size, size_t align) {
+    struct region_t *region = region_create(size, align);
+    if (unlikely(!region)) return invalid_shared;
+
+    region->engine = &tl2_mv_engine;
+    if (unlikely(!region_enable_history(region))) {
+        LOG_WARNING("tl2_mv_create: failed to allocate stripe histories.\n");
+        region_destroy(region);
+        return invalid_shared;
+    }
+    if (unlikely(!tl2_enable_segment_ids(region))) {
+        LOG_WARNING("tl2_mv_create: failed to allocate the segment directory.\n");
+        region_destroy(region);
+        return invalid_shared;
+    }
+    return (shared_t) region;
+}
+
+static void tl2_destroy(shared_t shared) {
+    region_destroy((struct region_t *)shared);
+}
+
+static void* tl2_start(shared_t shared) {
+    return region_start((struct region_t *) shared);
+}
+
+static size_t tl2_size(shared_t shared) {
+    return region_size((struct region_t *) shared);
+}
+
+static size_t tl2_align(shared_t shared) {
+    return region_align((struct region_t *) shared);
+}
+
+static tx_t tl2_begin(shared_t shared, bool is_ro) {
+    LOG_LOG("tl2_begin: creating new transaction.\n");
+    
+    struct region_t *region = (struct region_t *) shared;
+    struct txn_t *txn = txn_create(region, is_ro);
+
+    // If transaction creation failed, return invalid_tx
+    if (unlikely(!txn)) {
+        LOG_TEST("tl2_begin: transaction creation failed.\n");
+        return invalid_tx;
+    }
+    LOG_LOG("tl2_begin: transaction %lu was successfully created.\n", (tx_t) txn);
+
+    return (tx_t) txn;
+}
+
+static bool tl2_end(shared_t shared, tx_t tx) {
+    struct txn_t *txn = (struct txn_t *) tx;
+    struct region_t *region = (struct region_t *) shared;
+
+    // Try committing transaction, then keep its allocations and queue its frees
+    bool result = txn_end(txn, region);
+    bool should_free_region = result && region_commit_logs(region, &txn->allocs, &txn->frees);
+
+    // Free transaction and return
+    txn_destroy(txn, region);
+
+    if (unlikely(should_free_region)) {
+        // LOG_TEST("tl2_end: transaction %lu is freeing some shared memory segments\n");
+        region_schedule_free(region);
+    }
+    return result;
+}
+
+static bool tl2_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) {
+    LOG_LOG("tl2_read: transaction %lu is reading %lu bytes from %p to %p\n", tx, size, source, target);
+
+    bool read_result = txn_read((struct txn_t *) tx, (struct region_t *) shared, source, size, target);
+
+    if (likely(read_result == SUCCESS)) {
+        LOG_LOG("tl2_read: transaction %lu read was a success!\n", tx);
+    } else {
+        LOG_WARNING("tl2_read: transaction %lu read failed and transaction must abort!\n", tx);
+    }
+    return read_result;
+}
+
+static bool tl2_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) {
+    LOG_LOG("tl2_write: transaction %lu is writing %lu bytes from %p to %p\n", tx, size, source, target);
+    
+    bool write_result = txn_write((struct txn_t *) tx, (struct region_t *) shared, source, size, target);
+
+    if (likely(write_result == SUCCESS)) {
+        LOG_LOG("tl2_write: transaction %lu write was a success!\n", tx);
+    } else {
+        LOG_WARNING("tl2_write: transaction %lu write failed and transaction must abort!\n", tx);
+    }
+    return write_result;
+}
+
+static alloc_t tl2_alloc(shared_t shared, tx_t tx, size_t size, void** target) {
+    LOG_LOG("tl2_alloc: transaction %lu is allocating %lu bytes\n", tx, size);
+
+    struct region_t *region = (struct region_t *) shared;
+    struct segment_node_t *node = region_alloc_logged(region, &((struct txn_t *) tx)->allocs, region_storage_size(region, size));
+    if (unlikely(!node)) {
+        LOG_WARNING("tl2_alloc: transaction %lu allocation failed\n", tx);
+        return nomem_alloc;
+    } 
+    LOG_WARNING("tl2_alloc: transaction %lu allocation was successful!\n", tx);
+
+    // Set target to newly allocated memory region (tagged with its id if the region hands out ids)
+    *target = region_segment_address(node);
+    return success_alloc;
+}
+
+static bool tl2_free(shared_t unused(shared), tx_t tx, void* target) {
+    return txn_schedule_to_free((struct txn_t *) tx, target);
+}
+
+struct engine_t const tl2_engine = {
+    .name    = "tl2",
+    .create  = tl2_create,
+    .destroy = tl2_destroy,
+    .start   = tl2_start,
+    .size    = tl2_size,
+    .align   = tl2_align,
+    .begin   = tl2_begin,
+    .end     = tl2_end,
+    .read    = tl2_read,
+    .write   = tl2_write,
+    .alloc   = tl2_alloc,
+    .free    = tl2_free,
+};
+
+struct engine_t const tl2_mv_engine = {
+    .name    = "tl2-mv",
+    .create  = tl2_mv_create,
+    .destroy = tl2_destroy,
+    .start   = tl2_start,
+    .size    = tl2_size,
+    .align   = tl2_align,
+    .begin   = tl2_begin,
+    .end     = tl2_end,
+    .read    = tl2_read,
+    .write   = tl2_write,
+    .alloc   = tl2_alloc,
+    .free    = tl2_free,
+};
\ No newline at end of file
@@ -25,36 +25,27 @@
 // Internal headers
 #include <tm.h>
 
+#include "engine.h"
 #include "helper.h"
 #include "macros.h"
-#include "v_lock.h"
-#include "txn.h"
-#include "shared.h"
 
 /** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
+ * The region is run by the engine selected by engine_select (TM_ENGINE environment variable).
  * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
  * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
  * @return Opaque shared memory region handle, 'invalid_shared' on failure
 **/
 shared_t tm_create(size_t size, size_t align) {
-    LOG_LOG("tm_create: creating new transactional machine.\n");
-    
-    struct region_t *region = region_create(size, align);
-    // If shared memory region allocation failed, return invalid_shared
-    if (unlikely(!region)) {
-        LOG_WARNING("tm_create: transactional machine shared memory region creation failed.\n");
-        return invalid_shared;
-    } 
-    LOG_LOG("tm_create: transactional machine shared memory region %p of size %lu and alignement %lu was successfully created.\n", (shared_t) region, size, align);
-    
-    return (shared_t) region;
+    struct engine_t const *engine = engine_select();
+    LOG_LOG("tm_create: creating new transactional machine with engine '%s'.\n", engine->name);
+    return engine->create(size, align);
 }
 
 /** Destroy (i.e. clean-up + free) a given shared memory region.
  * @param shared Shared memory region to destroy, with no running transaction
 **/
 void tm_destroy(shared_t shared) {
-    region_destroy((struct region_t *)shared);
+    engine_of(shared)->destroy(shared);
 }
 
 /** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
@@ -62,7 +53,7 @@ void tm_destroy(shared_t shared) {
  * @return Start address of the first allocated segment
 **/
 void* tm_start(shared_t shared) {
-    return region_start((struct region_t *) shared);
+    return engine_of(shared)->start(shared);
 }
 
 /** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
@@ -70,7 +61,7 @@ void* tm_start(shared_t shared) {
  * @return First allocated segment size
  **/
 size_t tm_size(shared_t shared) {
-    return region_size((struct region_t *) shared);
+    return engine_of(shared)->size(shared);
 }
 
 /** [thread-safe] Return the alignment (in bytes) of the memory accesses on the given shared memory region.
@@ -78,7 +69,7 @@ size_t tm_size(shared_t shared) {
  * @return Alignment used globally
  **/
 size_t tm_align(shared_t shared) {
-    return region_align((struct region_t *) shared);
+    return engine_of(shared)->align(shared);
 }
 
 /** [thread-safe] Begin a new transaction on the given shared memory region.
@@ -87,19 +78,7 @@ size_t tm_align(shared_t shared) {
  * @return Opaque transaction ID, 'invalid_tx' on failure
 **/
 tx_t tm_begin(shared_t shared, bool is_ro) {
-    LOG_LOG("tm_begin: creating new transaction.\n");
-    
-    struct region_t *region = (struct region_t *) shared;
-    struct txn_t *txn = txn_create(region, is_ro);
-
-    // If transaction creation failed, return invalid_tx
-    if (unlikely(!txn)) {
-        LOG_TEST("tm_begin: transaction creation failed.\n");
-        return invalid_tx;
-    }
-    LOG_LOG("tm_begin: transaction %lu was successfully created.\n", (tx_t) txn);
-
-    return (tx_t) txn;
+    return engine_of(shared)->begin(shared, is_ro);
 }
 
 /** [thread-safe] End the given transaction.
@@ -108,25 +87,7 @@ tx_t tm_begin(shared_t shared, bool is_ro) {
  * @return Whether the whole transaction committed
 **/
 bool tm_end(shared_t shared, tx_t tx) {
-    struct txn_t *txn = (struct txn_t *) tx;
-    struct region_t *region = (struct region_t *) shared;
-
-    // Try committing transaction
-    bool result = txn_end(txn, region);
-    bool should_free_region = 
-        result &&                                                       // only free if transaction has successfully committed
-        !(txn->is_ro || txn->w_set->count == 0) &&                      // If effectively a read-only transaction, do not free
-        (region->to_free_count    >= SEGMENT_FREE_BATCH_SIZE ||         // If too many segments, free
-            region->to_free_cum_size >= SEGMENT_FREE_BATCH_CUM_SIZE);   // If segment free cumulated siz is too big, free
-
-    // Free transaction and return
-    txn_destroy(txn, region);
-
-    if (unlikely(should_free_region)) {
-        // LOG_TEST("tm_end: transaction %lu is freeing some shared memory segments\n");
-        region_free(region);
-    }
-    return result;
+    return engine_of(shared)->end(shared, tx);
 }
 
 /** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
@@ -138,16 +99,7 @@ bool tm_end(shared_t shared, tx_t tx) {
  * @return Whether the whole transaction can continue
 **/
 bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) {
-    LOG_LOG("tm_read: transaction %lu is reading %lu bytes from %p to %p\n", tx, size, source, target);
-
-    bool read_result = txn_read((struct txn_t *) tx, (struct region_t *) shared, source, size, target);
-
-    if (likely(read_result == SUCCESS)) {
-        LOG_LOG("tm_read: transaction %lu read was a success!\n", tx);
-    } else {
-        LOG_WARNING("tm_read: transaction %lu read failed and transaction must abort!\n", tx);
-    }
-    return read_result;
+    return engine_of(shared)->read(shared, tx, source, size, target);
 }
 
 /** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
@@ -159,16 +111,7 @@ bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* ta
  * @return Whether the whole transaction can continue
 **/
 bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) {
-    LOG_LOG("tm_write: transaction %lu is writing %lu bytes from %p to %p\n", tx, size, source, target);
-    
-    bool write_result = txn_write((struct txn_t *) tx, (struct region_t *) shared, source, size, target);
-
-    if (likely(write_result == SUCCESS)) {
-        LOG_LOG("tm_write: transaction %lu write was a success!\n", tx);
-    } else {
-        LOG_WARNING("tm_write: transaction %lu write failed and transaction must abort!\n", tx);
-    }
-    return write_result;
+    return engine_of(shared)->write(shared, tx, source, size, target);
 }
 
 /** [thread-safe] Memory allocation in the given transaction.
@@ -178,23 +121,8 @@ bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* t
  * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
  * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
 **/
-alloc_t tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) {
-    LOG_LOG("tm_alloc: transaction %lu is allocating %lu bytes\n", tx, size);
-
-    struct segment_node_t *node = region_alloc((struct region_t *) shared, size);
-    if (unlikely(!node)) {
-        LOG_WARNING("tm_alloc: transaction %lu allocation failed\n", tx);
-        return nomem_alloc;
-    } 
-    LOG_WARNING("tm_alloc: transaction %lu allocation was successful!\n", tx);
-
-    // create pointer to start of memory region
-    void *data = (void *) ((uintptr_t) node + sizeof(struct segment_node_t));
-    memset(data, 0, size);
-
-    // Set target to newly allocated memory region
-    *target =  data;
-    return success_alloc;
+alloc_t tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) {
+    return engine_of(shared)->alloc(shared, tx, size, target);
 }
 
 /** [thread-safe] Memory freeing in the given transaction.
@@ -203,6 +131,6 @@ alloc_t tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) {
  * @param target Address of the first byte of the previously allocated segment to deallocate
  * @return Whether the whole transaction can continue
 **/
-bool tm_free(shared_t unused(shared), tx_t tx, void* target) {
-    return txn_schedule_to_free((struct txn_t *) tx, target);
-}
+bool tm_free(shared_t shared, tx_t tx, void* target) {
+    return engine_of(shared)->free(shared, tx, target);
+}
\ No newline at end of file
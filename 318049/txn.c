@@ -1,74 +1,146 @@
 #include "txn.h"
 #include "shared.h"
 
+// ------- descriptor pool -------
+
+/**
+ * Free a descriptor of the pool, with its sets
+ */
+static void txn_pool_destroy(struct desc_pool_node_t *node);
+
+static _Thread_local struct desc_pool_t txn_pool = { .destroy = txn_pool_destroy };
+
+/**
+ * Allocate a new descriptor, with its sets, for the calling thread
+ */
+static struct txn_t *txn_alloc(size_t word_size);
+
+static void txn_free(struct txn_t *txn);
+
+// ------- txn_read helper -------
+
+/**
+ * Try extending the snapshot of a read-write transaction to the current global clock
+ * (LSA-style timestamp extension): if no stripe in the read log changed since txn->rv,
+ * the reads done so far are still consistent at the current clock and txn->rv moves forward.
+ * @param version lock version the snapshot has to reach
+ * @return Whether the snapshot was extended
+ */
+static bool txn_extend(struct txn_t *txn, struct region_t *region, version_t version);
+
+/**
+ * Read a word of a stripe newer than the snapshot of a read-only transaction from the stripe history
+ * (multi-version mode).
+ * @param lv_pre version of the stripe lock sampled before the read
+ * @return Whether the value at the snapshot was read
+ */
+static bool txn_read_history(struct txn_t *txn, struct region_t *region, uintptr_t lock_index, version_t lv_pre, void const *source, void *target);
+
 // ------- txn_end helper -------
 
-static bool txn_lock(struct txn_t *txn, struct region_t *region, uint64_t *lock_field);
+/**
+ * w_set_get_lock_set callback: stripe of target in the region given as context
+ */
+static stripe_t txn_stripe_of(void *region, void const *target);
+
+static bool txn_lock(struct txn_t *txn, struct region_t *region);
 
 /**
  * @return Whether tx->rv + 1 == wv
  */
-static bool txn_set_wv(struct txn_t *txn, int wv);
+static bool txn_set_wv(struct txn_t *txn, version_t wv);
 
-static bool txn_validate_r_set(struct region_t *region, struct set_t *rs, int rv);
+/**
+ * Stripes locked by the transaction itself (owner id in the lock word) are validated against the version they had when acquired
+ */
+static bool txn_validate_r_log(struct txn_t *txn, struct region_t *region);
 
-static void txn_w_commit(struct set_t *ws);
+/**
+ * Write back the write set; in multi-version mode the overwritten words are pushed to the stripe histories first
+ */
+static void txn_w_commit(struct txn_t *txn, struct region_t *region);
 
-static void txn_unlock(struct txn_t *txn, struct region_t *region, uint64_t *lock_field, size_t last, bool committed);
+static void txn_unlock(struct txn_t *txn, struct region_t *region, size_t last, bool committed);
+
+/**
+ * Record the commit with the contention manager; the caller makes the allocations and frees permanent (see region_commit_logs)
+ */
+static void txn_committed(struct txn_t *txn, struct region_t *region);
+
+/**
+ * Report an abort to the contention manager of the region, before the transaction is destroyed
+ */
+static void txn_aborted(struct txn_t *txn, struct region_t *region);
 
 // ============================================= global functions =============================================
 
 struct txn_t *txn_create(struct region_t *region, bool is_ro) {
-    pthread_rwlock_rdlock(&region->free_lock);      // Stops another transaction from freeing any shared memory regions
+    // Keeps the segments this transaction may access from being reclaimed
+    if (unlikely(!ebr_enter())) {
+        LOG_TEST("txn_create: epoch registration failed!\n");
+        return NULL;
+    }
 
-    struct txn_t *txn = malloc(sizeof(struct txn_t));
+    struct txn_t *txn = desc_pool_take(&txn_pool);
     if (unlikely(!txn)) {
-        LOG_TEST("txn_create: memory allocation for transaction failed!\n");
+        txn = txn_alloc(region->align);
+        if (unlikely(!txn)) {
+            LOG_TEST("txn_create: memory allocation for transaction failed!\n");
+            ebr_leave();
+            return NULL;
+        }
+    }
+
+    // Reset the sets, keeping their capacity
+    r_log_reset(txn->r_log);
+    if (unlikely(!w_set_reset(txn->w_set, region->align))) {
+        LOG_TEST("txn_create: write set reset failed!\n");
+        txn_free(txn);
+        ebr_leave();
         return NULL;
     }
 
     txn->is_ro = is_ro;
+    txn->owner = ebr_thread_id();
+    txn->work = 0;
+    cm_begin(region->cm_policy, txn->owner);
     txn->rv = global_clock_load(&region->version_clock);
     txn->wv = INVALID;       // invalid write version
-
-    txn->r_set = set_init(false, region->align);
-    if (unlikely(!txn->r_set)) {
-        LOG_TEST("txn_create: read set_init failed!\n");
-        free(txn);
-        return NULL;
-    }
-    txn->w_set = set_init(true, region->align);
-    if (unlikely(!txn->w_set)) {
-        LOG_TEST("txn_create: write set_init failed!\n");
-        set_free(txn->w_set);
-        free(txn);
-        return NULL;
+    txn->snapshot = INVALID;
+    txn->l_set->count = 0;
+    txn->frees.count = 0;
+    txn->allocs.count = 0;
+
+    // Keep the history this snapshot may need from being garbage-collected
+    if (unlikely(is_ro && region->histories)) {
+        txn->snapshot = region_register_snapshot(region, &txn->rv);
     }
 
-    txn->to_free = NULL;
-    txn->to_free_count = 0;
-
     // LOG_NOTE("txn_create: transaction %lu created.\n", (tx_t) txn);
     return txn;
 }
 
 void txn_destroy(struct txn_t *txn, struct region_t *region) {
-    // Release lock to allow a transaction to free a batch of shared memory segments
-    pthread_rwlock_unlock(&region->free_lock);      
+    // Allow the segments retired while this transaction ran to be reclaimed
+    ebr_leave();
     
     if (unlikely(!txn)) return;
+
+    // Still logged allocations belong to an aborted transaction
+    if (unlikely(txn->allocs.count > 0)) {
+        region_rollback_allocs(region, &txn->allocs);
+    }
+
+    if (unlikely(txn->snapshot != INVALID)) {
+        region_unregister_snapshot(region, txn->snapshot);
+    }
     
-    set_free(txn->r_set);
-    set_free(txn->w_set);
-    free(txn);
+    // Return descriptor to the thread's pool
+    desc_pool_put(&txn_pool, txn);
 }
 
 bool txn_schedule_to_free(struct txn_t *txn, void *target) {
-    txn->to_free = realloc(txn->to_free, (txn->to_free_count + 1) * sizeof(void *));
-    if (unlikely(!txn->to_free)) return ABORT;
-
-    txn->to_free[txn->to_free_count++] = target;
-    return SUCCESS;
+    return free_log_add(&txn->frees, target) ? SUCCESS : ABORT;
 }
 
 bool txn_is_ro(struct txn_t *txn) {
@@ -77,64 +149,115 @@ bool txn_is_ro(struct txn_t *txn) {
 
 bool txn_read(struct txn_t *txn, struct region_t *region, void const *source, size_t size, void *target) {
     size_t word_size = region->align;
-   
-    for (size_t i = 0; i < size; i += word_size) {
+    bool check_w_set = !txn->is_ro && txn->w_set->count > 0;
+    stripe_t next_stripe = 0;
+    bool next_known = false;    // Whether next_stripe is the stripe of the word at i, found while extending a run
+    txn->work += size >> region->align_shift;
+
+    for (size_t i = 0; i < size; ) {
         void *source_addr = (char *)source +i;
         void *target_addr = (char *)target +i;
 
-        if (unlikely(!txn->is_ro)) {
+        if (unlikely(check_w_set)) {
             // Check if address has been written to during this trasaction
-            write_entry_t *entry = (write_entry_t *) set_get(txn->w_set, source_addr);
-            if (unlikely(entry)) {
+            void *data = w_set_get(txn->w_set, source_addr);
+            if (unlikely(data)) {
                 LOG_NOTE("txn_read: transaction %lu read from write set for source: %p!\n", (tx_t) txn, source_addr);
-                memcpy(target_addr, entry->data, word_size);
+                memcpy(target_addr, data, word_size);
+                next_known = false;
+                i += word_size;
                 continue;
             }
         }
 
         // Determine lock associated to shared memory region
-        v_lock_t *lock = region_get_memory_lock_from_ptr(region, source_addr);
-
-        // Verify lock is free (without acquiring it)
-        int lv_pre = v_lock_version(lock);
-        if ((lv_pre == LOCKED) || (lv_pre > txn->rv)) {
+        stripe_t lock_index = next_known ? next_stripe : region_get_stripe(region, source_addr);
+        next_known = false;
+        v_lock_t *lock = region_get_memory_lock_from_index(region, lock_index);
+
+        // Verify lock is free (without acquiring it); a newer version aborts unless the snapshot can be extended
+        version_t lv_pre = v_lock_version(lock);
+        if (unlikely(lv_pre == LOCKED)) {
+            // Held by a committing transaction, which releases it soon: wait a little, then ask the contention manager
+            unsigned spins = region->lock_spins;
+            if (v_lock_wait(lock, &spins) || cm_wait(region->cm_policy, txn->owner, txn->work, lock)) lv_pre = v_lock_version(lock);
+        }
+        if (unlikely(txn->snapshot != INVALID && lv_pre != LOCKED && lv_pre > txn->rv)) {
+            // Multi-version mode: read the value the word had at the snapshot
+            if (unlikely(!txn_read_history(txn, region, lock_index, lv_pre, source_addr, target_addr))) {
+                LOG_WARNING("txn_read: transaction %lu failed to read source: %p from history!\n", (tx_t) txn, source_addr);
+                txn_aborted(txn, region);
+                txn_destroy(txn, region);
+                return ABORT;
+            }
+            i += word_size;
+            continue;
+        }
+        if (unlikely(lv_pre != LOCKED && lv_pre > txn->rv) && !txn->is_ro && txn_extend(txn, region, lv_pre)) {
+            // Lazy clock schemes may give the next commit of the stripe the same version: check it after the extension
+            lv_pre = v_lock_version(lock);
+        }
+        if ((lv_pre == LOCKED) || lv_pre > txn->rv) {
             LOG_WARNING("txn_read: transaction %lu failed lock PRE-validation for source: %p -> lock %p!\n", (tx_t) txn, source_addr, lock);
+            // The retry must not start behind the version seen, nor race the holder again
+            if (lv_pre != LOCKED) region_observe_version(region, lv_pre);
+            else cm_conflict(region->cm_policy, txn->owner, lock, lock_index);
+            txn_aborted(txn, region);
             txn_destroy(txn, region);
             return ABORT; 
         }
 
-        memcpy(target_addr, source_addr, word_size);
+        // The following words of the same stripe are read and validated at once
+        size_t run = word_size;
+        while (i + run < size) {
+            void const *next_addr = (char const *) source + i + run;
+            next_stripe = region_get_stripe(region, next_addr);
+            if (next_stripe != lock_index) {
+                next_known = true;
+                break;
+            }
+            if (unlikely(check_w_set) && w_set_get(txn->w_set, next_addr)) break;
+            run += word_size;
+        }
+
+        void const *value = unlikely(region->cells) ? (char *) lock + region->cell_header : region_resolve(region, source_addr);
+        memcpy(target_addr, value, run);
 
         // Lock post-validation
-        int lv_post = v_lock_version(lock);
+        version_t lv_post = v_lock_version(lock);
         if ((lv_post == LOCKED) || (lv_post != lv_pre)) {
             LOG_WARNING("txn_read: transaction %lu failed lock POST-validation for source: %p -> lock %p\n", (tx_t) txn, source_addr, lock);
+            txn_aborted(txn, region);
             txn_destroy(txn, region);
             return ABORT; 
         }
 
         if (unlikely(!txn->is_ro)) {
-            // Add to read set
-            if (unlikely(!r_set_add(txn->r_set, source_addr))) {
-                LOG_WARNING("txn_read: transaction %lu failed add source: %p to read-set!\n", (tx_t) txn, source_addr);
+            // Add stripe to read log
+            if (unlikely(!r_log_add(txn->r_log, lock_index))) {
+                LOG_WARNING("txn_read: transaction %lu failed add source: %p to read-log!\n", (tx_t) txn, source_addr);
+                txn_aborted(txn, region);
                 txn_destroy(txn, region);
                 return ABORT;
             }
         }
+        i += run;
     }
     return SUCCESS;
 }
 
 bool txn_write(struct txn_t *txn, struct region_t *region, void const *source, size_t size, void *target) {
     size_t word_size = region->align;
+    txn->work += size >> region->align_shift;
    
     for (size_t i = 0; i < size; i += word_size) {
         void *source_addr = (char *)source +i;
         void *target_addr = (char *)target +i;
 
         // Add to write set
-        if (unlikely(!w_set_add(txn->w_set, source_addr, word_size, target_addr))) {
+        if (unlikely(!w_set_add(txn->w_set, source_addr, target_addr))) {
             LOG_WARNING("txn_write: transaction %lu failed to add entry {source: %p, target: %p, size: %p} to write set!\n", (tx_t) txn, source_addr, target_addr, word_size);
+            txn_aborted(txn, region);
             txn_destroy(txn, region);
             return ABORT;
         }
@@ -143,101 +266,205 @@ bool txn_write(struct txn_t *txn, struct region_t *region, void const *source, s
 }
 
 bool txn_end(struct txn_t *txn, struct region_t *region) {
-    // append scheduled memory frees to region
-    if (unlikely(txn->to_free_count > 0))
-        region_append_to_free(region, txn->to_free, txn->to_free_count);
-
     // If transaction is read only or no writes occured (effectively read-only), directly commit
-    if (likely(txn->is_ro || txn->w_set->count == 0)) return SUCCESS;
+    if (likely(txn->is_ro || txn->w_set->count == 0)) {
+        txn_committed(txn, region);
+        return SUCCESS;
+    }
 
     // If transaction is read write, perform additional steps
-    uint64_t lock_field[VLOCK_NUM / 64];
-    set_get_lock_field(txn->w_set, lock_field);
+    if (unlikely(!w_set_get_lock_set(txn->w_set, txn->l_set, txn_stripe_of, region))) {
+        LOG_WARNING("txn_end: transaction %lu failed to build lock set!\n", (tx_t) txn);
+        txn_aborted(txn, region);
+        return ABORT;
+    }
 
     // Lock the write-set
-    if (unlikely(!txn_lock(txn, region, lock_field))) {
+    if (unlikely(!txn_lock(txn, region))) {
         LOG_WARNING("txn_end: transaction %lu failed to lock write-set!\n", (tx_t) txn);
+        txn_aborted(txn, region);
         return ABORT;
     }
 
-    // Increment global version clock
-    int wv = region_update_version_clock(region);
+    // Get the write version from the global version clock
+    bool exclusive;
+    version_t wv = region_update_version_clock(region, &exclusive);
     
-    if (likely(!txn_set_wv(txn, wv))) {
+    if (likely(!txn_set_wv(txn, wv) || !exclusive)) {
         // Validate the read set
-        if (unlikely(!txn_validate_r_set(region, txn->r_set, txn->rv))){
-            LOG_WARNING("txn_end: transaction %lu failed to validate read-set!\n", (tx_t) txn);
-            txn_unlock(txn, region, lock_field, VLOCK_NUM, false);
+        if (unlikely(!txn_validate_r_log(txn, region))){
+            LOG_WARNING("txn_end: transaction %lu failed to validate read-log!\n", (tx_t) txn);
+            txn_unlock(txn, region, txn->l_set->count, false);
+            txn_aborted(txn, region);
             return ABORT;
         } 
     }
     
     // Commit
-    txn_w_commit(txn->w_set);
+    txn_w_commit(txn, region);
     
     // Release locks and update their write version
-    txn_unlock(txn, region, lock_field, VLOCK_NUM, true);
+    txn_unlock(txn, region, txn->l_set->count, true);
+    txn_committed(txn, region);
     return SUCCESS;
 }
 
 // ============================================= static functions implementation =============================================
-static bool txn_lock(struct txn_t *txn, struct region_t *region, uint64_t *lock_field) {
-    for (size_t i = 0; i < VLOCK_NUM; i++) {
-        if (get_bit(lock_field, i)) {
-            v_lock_t *lock = region_get_memory_lock_from_index(region, i);
-            if (!v_lock_acquire(lock)) {
-                // Failed to acquire lock -> unlock acquired locks & abort transaction
-                txn_unlock(txn, region, lock_field, i, false);
-                return ABORT;
-            }
+static void txn_pool_destroy(struct desc_pool_node_t *node) {
+    txn_free((struct txn_t *) node);
+}
+
+static struct txn_t *txn_alloc(size_t word_size) {
+    // Register the pool so that it is freed on thread exit
+    desc_pool_register(&txn_pool);
+
+    struct txn_t *txn = malloc(sizeof(struct txn_t));
+    if (unlikely(!txn)) return NULL;
+
+    txn->r_log = r_log_init();
+    if (unlikely(!txn->r_log)) {
+        LOG_TEST("txn_alloc: read r_log_init failed!\n");
+        free(txn);
+        return NULL;
+    }
+    txn->w_set = w_set_init(word_size);
+    if (unlikely(!txn->w_set)) {
+        LOG_TEST("txn_alloc: write set_init failed!\n");
+        r_log_free(txn->r_log);
+        free(txn);
+        return NULL;
+    }
+    txn->l_set = lock_set_init();
+    if (unlikely(!txn->l_set)) {
+        LOG_TEST("txn_alloc: lock_set_init failed!\n");
+        w_set_free(txn->w_set);
+        r_log_free(txn->r_log);
+        free(txn);
+        return NULL;
+    }
+
+    txn->frees = (struct free_log_t) {0};
+    txn->allocs = (struct alloc_log_t) {0};
+    return txn;
+}
+
+static void txn_free(struct txn_t *txn) {
+    r_log_free(txn->r_log);
+    w_set_free(txn->w_set);
+    lock_set_free(txn->l_set);
+    free_log_free(&txn->frees);
+    alloc_log_free(&txn->allocs);
+    free(txn);
+}
+
+static bool txn_extend(struct txn_t *txn, struct region_t *region, version_t version) {
+    // Sample the clock before validating: every version up to it is then covered by the validation
+    region_observe_version(region, version);
+    version_t rv = global_clock_load(&region->version_clock);
+    if (unlikely(!txn_validate_r_log(txn, region))) return false;
+
+    LOG_NOTE("txn_extend: transaction %lu extended its snapshot from %ld to %ld\n", (tx_t) txn, txn->rv, rv);
+    txn->rv = rv;
+    return true;
+}
+
+static bool txn_read_history(struct txn_t *txn, struct region_t *region, uintptr_t lock_index, version_t lv_pre, void const *source, void *target) {
+    struct mv_history_t *history = region_get_history(region, lock_index);
+    if (unlikely(!history)) return false;
+
+    enum mv_lookup_t lookup = mv_history_lookup(history, region->align, source, txn->rv, target);
+    if (unlikely(lookup == MV_EVICTED)) return false;
+    if (lookup == MV_CURRENT) {
+        memcpy(target, region_resolve(region, source), region->align);
+    }
+
+    // The history and the word are only consistent if no commit touched the stripe meanwhile
+    return v_lock_version(region_get_memory_lock_from_index(region, lock_index)) == lv_pre;
+}
+
+static stripe_t txn_stripe_of(void *region, void const *target) {
+    return region_get_stripe(region, target);
+}
+
+static bool txn_lock(struct txn_t *txn, struct region_t *region) {
+    // Transactions meeting these locks compare their priority to this one
+    cm_publish(region->cm_policy, txn->owner, txn->work);
+
+    // Stripes are sorted, so locks are always acquired in the same global order (waiting for one can't deadlock)
+    for (size_t i = 0; i < txn->l_set->count; i++) {
+        v_lock_t *lock = region_get_memory_lock_from_index(region, txn->l_set->stripes[i]);
+        unsigned spins = region->lock_spins;
+        while (!v_lock_acquire(lock, txn->owner)) {
+            // Spin on the held lock while the budget lasts, then ask the contention manager
+            if (v_lock_wait(lock, &spins) || cm_wait(region->cm_policy, txn->owner, txn->work, lock)) continue;
+            // Failed to acquire lock -> unlock acquired locks & abort transaction
+            cm_conflict(region->cm_policy, txn->owner, lock, txn->l_set->stripes[i]);
+            txn_unlock(txn, region, i, false);
+            return ABORT;
         }
     }
     return SUCCESS;
 }
 
-static bool txn_set_wv(struct txn_t *txn, int wv) {
+static bool txn_set_wv(struct txn_t *txn, version_t wv) {
     txn->wv = wv;
     return txn->rv+1 == wv;
 }
 
-static bool txn_validate_r_set(struct region_t *region, struct set_t *rs, int rv) {
-    // Iterate through read set
-    for (size_t i = 0; i < rs->capacity; i++) {
-        if (get_bit(rs->occupied_field, i)) {
-            read_entry_t *entry = rs->entries[i];
-            v_lock_t *lock = region_get_memory_lock_from_ptr(region, entry->target);
-    
-            int lv = v_lock_version(lock);
-            // If lock is not acquirable or the lock version clock is higher than tx->rv, abort.
-            if (lv == LOCKED || lv > rv) {
-                return ABORT;
-            }
+static bool txn_validate_r_log(struct txn_t *txn, struct region_t *region) {
+    struct r_log_t *rl = txn->r_log;
+
+    // Iterate through read log
+    for (size_t i = 0; i < rl->count; i++) {
+        v_lock_t *lock = region_get_memory_lock_from_index(region, rl->stripes[i]);
+
+        // Locked by another transaction: abort. Locked by this one: check the version it was acquired at.
+        version_t lv = v_lock_version_for(lock, txn->owner);
+        if (unlikely(lv == LOCKED)) return ABORT;
+        // If the lock version clock is higher than tx->rv, abort.
+        if (lv > txn->rv) {
+            return ABORT;
         }
     }
     return SUCCESS;
 }
 
-static void txn_w_commit(struct set_t *ws) {
+static void txn_w_commit(struct txn_t *txn, struct region_t *region) {
+    struct w_set_t *ws = txn->w_set;
+    // Without registered snapshots, no reader can need the overwritten words
+    version_t oldest_snapshot = region->histories ? region_oldest_snapshot(region) : MV_NO_SNAPSHOT;
+
     // Iterate through write set and write values
     for (size_t i = 0; i < ws->capacity; i++) {
-        if (get_bit(ws->occupied_field, i)) {
-            write_entry_t *we = (write_entry_t *) ws->entries[i];
-            memcpy(we->base.target, we->data, ws->data_size);
+        void *target = w_set_slot_target(ws, i);
+        if (target) {
+            if (unlikely(oldest_snapshot != MV_NO_SNAPSHOT)) {
+                // Keep the overwritten word for older snapshots (readers abort on stripes without history)
+                struct mv_history_t *history = region_get_or_create_history(region, region_get_stripe(region, target));
+                if (likely(history)) mv_history_push(history, ws->word_size, target, region_resolve(region, target), txn->wv, oldest_snapshot);
+            }
+            memcpy(region_resolve(region, target), w_set_slot_data(ws, i), ws->word_size);
         }
     }
 }
 
-static void txn_unlock(struct txn_t *txn, struct region_t *region, uint64_t *lock_field, size_t last, bool committed) {    
+static void txn_unlock(struct txn_t *txn, struct region_t *region, size_t last, bool committed) {    
     for (size_t i = 0; i < last; i++) {
-        if (get_bit(lock_field, i)) {
-            v_lock_t *lock = region_get_memory_lock_from_index(region, i);
-        
-            // If transaction has committed, update lock versions
-            if (unlikely(committed)) {
-                v_lock_release_and_update(lock, txn->wv);
-            } else {
-                v_lock_release(lock);
-            }
+        v_lock_t *lock = region_get_memory_lock_from_index(region, txn->l_set->stripes[i]);
+
+        // If transaction has committed, update lock versions
+        if (unlikely(committed)) {
+            v_lock_release_and_update(lock, txn->wv);
+        } else {
+            v_lock_release(lock);
         }
     }
-}
\ No newline at end of file
+}
+
+static void txn_committed(struct txn_t *txn, struct region_t *region) {
+    cm_commit(region->cm_policy, txn->owner);
+}
+
+static void txn_aborted(struct txn_t *txn, struct region_t *region) {
+    cm_abort(region->cm_policy, txn->owner, txn->work);
+}
@@ -10,26 +10,33 @@
 #include "tm.h"
 #include "v_lock.h"
 #include "map.h"
+#include "pool.h"
+#include "shared.h"
 #include "macros.h"
 
 struct region_t; // Forward declaration
 
 struct txn_t {
+    struct desc_pool_node_t pool_node;  // Link in the thread's descriptor pool, while this one is unused
     bool is_ro;
-    int rv;
-    int wv;
+    version_t rv;
+    version_t wv;
+    unsigned owner;     // Id of the thread running the transaction, owner of the locks it holds (see ebr_thread_id)
+    uint64_t work;      // Words accessed so far, the priority of some contention managers
+    int snapshot;   // Registration slot of a read-only snapshot (multi-version mode), INVALID if none
 
-    // Read and write sets. Contain target address (struct segment_node_t *), data and size of data to be written
-    struct set_t *r_set;
-    struct set_t *w_set;
+    // Read log (stripe indices) and write set. The write set buffers the words to be written inline
+    struct r_log_t *r_log;
+    struct w_set_t *w_set;
+    struct lock_set_t *l_set;   // Stripes of the write set, built and locked at commit
 
-    // container with pointers to to-free memory regions
-    void **to_free;
-    size_t to_free_count;
+    struct free_log_t frees;    // Segments freed by the transaction, handed to the region once it committed
+    struct alloc_log_t allocs;  // Segments allocated by the transaction, rolled back if it aborts
 };
 
 /**
- * Allocate and initialize a new transaction object.
+ * Initialize a transaction object, taken from the calling thread's descriptor pool
+ * (allocated only when the pool is empty).
  *
  * Typical usage: the transaction manager calls this at transaction begin to
  * create state for a new transaction, then returns the resulting `struct txn_t *` to
@@ -44,7 +51,8 @@ struct txn_t {
 struct txn_t *txn_create(struct region_t *region, bool is_ro);
 
 /**
- * Free transaction resources and the transaction object itself.
+ * Release transaction resources and return the transaction object to the calling
+ * thread's descriptor pool.
  *
  * This function accepts a `struct txn_t *` value (that was previously returned by
  * `txn_create` or other internal helpers). If `tx == invalid_tx` the call is
@@ -6,45 +6,129 @@ void v_lock_init(v_lock_t *lock) {
 
 void v_lock_cleanup(v_lock_t * unused(lock)) { return; }
 
-bool v_lock_acquire(v_lock_t *lock) {
-    int old = atomic_load(lock);
+bool v_lock_acquire(v_lock_t *lock, unsigned owner) {
+    version_t old = atomic_load(lock);
     
     // Check if lock is free
     if (old & 0x1) return false;
 
-    if (atomic_compare_exchange_strong(lock, &old, old | 0x1)) {
+    if (atomic_compare_exchange_strong(lock, &old, old | ((version_t) owner << 1) | 0x1)) {
         return true;
     }
     return false;
 }
 
+bool v_lock_wait(v_lock_t *lock, unsigned *spins) {
+    while (atomic_load_explicit(lock, memory_order_relaxed) & 0x1) {
+        if (*spins == 0) return false;
+        (*spins)--;
+        spin_pause();
+    }
+    return true;
+}
+
 void v_lock_release(v_lock_t *lock) {
-    atomic_fetch_and(lock, ~1); // clears the lock bit
+    atomic_fetch_and(lock, ~(((version_t) 1 << LOCK_VERSION_SHIFT) - 1)); // clears the owner and the lock bit
 }
 
-void v_lock_release_and_update(v_lock_t* lock, int val) {
-    atomic_store(lock, val << 1);
+void v_lock_release_and_update(v_lock_t* lock, version_t val) {
+    atomic_store(lock, val << LOCK_VERSION_SHIFT);
 }
 
-int v_lock_version(v_lock_t *lock) {
-    int version = atomic_load(lock);
+version_t v_lock_version(v_lock_t *lock) {
+    version_t version = atomic_load(lock);
     // locked, return -1 (ERROR)
     if (version & 0x1) return LOCKED;
     // unlocked, return version
-    return version >> 1;
+    return version >> LOCK_VERSION_SHIFT;
+}
+
+version_t v_lock_owned_version(v_lock_t *lock) {
+    return atomic_load(lock) >> LOCK_VERSION_SHIFT;
+}
+
+version_t v_lock_version_for(v_lock_t *lock, unsigned owner) {
+    version_t word = atomic_load(lock);
+    if ((word & 0x1) && ((word >> 1) & ((1 << LOCK_OWNER_BITS) - 1)) != owner) return LOCKED;
+    return word >> LOCK_VERSION_SHIFT;
+}
+
+unsigned v_lock_owner(v_lock_t *lock) {
+    version_t word = atomic_load(lock);
+    return (word & 0x1) ? (unsigned) (word >> 1) & ((1 << LOCK_OWNER_BITS) - 1) : 0;
 }
 
 // =========== Global clock functions =========== 
+
+/**
+ * GV6: count a commit of the calling thread on the clock
+ * @return Whether this commit is the one out of CLOCK_GV6_PERIOD that increments the clock
+ */
+static bool global_clock_gv6_due(global_clock_t *global_clock) {
+    // Commits since the thread last incremented each clock, in a slot chosen by the clock's address
+    static _Thread_local struct {
+        global_clock_t *clock;
+        unsigned commits;
+    } counters[CLOCK_GV6_THREAD_SLOTS];
+
+    size_t slot = ((uintptr_t) global_clock / CLOCK_CACHE_LINE) % CLOCK_GV6_THREAD_SLOTS;
+    if (unlikely(counters[slot].clock != global_clock)) {
+        // Taken over from another clock: this commit increments, so that no clock waits for a whole period
+        counters[slot].clock = global_clock;
+        counters[slot].commits = CLOCK_GV6_PERIOD - 1;
+    }
+    if (likely(++counters[slot].commits < CLOCK_GV6_PERIOD)) return false;
+    counters[slot].commits = 0;
+    return true;
+}
+
 void global_clock_init(global_clock_t *global_clock) {
     atomic_init(global_clock, 0);
 }
 
 void global_clock_cleanup(global_clock_t * unused(global_clock)) { return; }
 
-int global_clock_load(global_clock_t *global_clock) {
+version_t global_clock_load(global_clock_t *global_clock) {
     return atomic_load(global_clock);
 }
 
-int global_clock_increment_and_fetch(global_clock_t *global_clock) {
+version_t global_clock_increment_and_fetch(global_clock_t *global_clock) {
     return atomic_fetch_add(global_clock, 1)+1;
+}
+
+version_t global_clock_next_version(global_clock_t *global_clock, enum clock_scheme_t scheme, bool *exclusive) {
+    bool unique = false;
+    version_t version;
+    switch (scheme) {
+    case CLOCK_GV4:
+        version = atomic_load(global_clock);
+        if (atomic_compare_exchange_strong(global_clock, &version, version + 1)) {
+            unique = true;
+            version++;
+        }
+        // Otherwise version holds the clock another commit incremented meanwhile: share it
+        break;
+    case CLOCK_GV6:
+        if (unlikely(global_clock_gv6_due(global_clock))) {
+            version = atomic_fetch_add(global_clock, 1) + 1;
+            break;
+        }
+        // fall through
+    case CLOCK_GV5:
+        // No write: the clock line stays shared between the committers
+        version = atomic_load(global_clock) + 1;
+        break;
+    default:
+        version = atomic_fetch_add(global_clock, 1) + 1;
+        unique = true;
+        break;
+    }
+
+    if (exclusive) *exclusive = unique;
+    return version;
+}
+
+void global_clock_advance(global_clock_t *global_clock, version_t version) {
+    version_t clock = atomic_load(global_clock);
+    while (clock < version && !atomic_compare_exchange_weak(global_clock, &clock, version));
 }
\ No newline at end of file
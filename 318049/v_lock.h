@@ -9,7 +9,8 @@
 #include "macros.h"
 
 /**
- * @brief A versioned spinlock.
+ * @brief A versioned spinlock: a 64-bit word holding the version, the id of the owner thread while the lock
+ * is held, and the lock bit (see LOCK_VERSION_SHIFT). The version keeps its value while the lock is held.
  */
 typedef version_clock_t v_lock_t;
 
@@ -29,9 +30,18 @@ void v_lock_cleanup(v_lock_t* lock);
 /**
  * Try acquiring lock
  * @param lock Lock to acquire
+ * @param owner id of the acquiring thread (see ebr_thread_id)
  * @return true if lock was acquired, false otherwise
  */
-bool v_lock_acquire(v_lock_t* lock);
+bool v_lock_acquire(v_lock_t* lock, unsigned owner);
+
+/**
+ * Wait for a lock held by another thread to be released, spending at most the remaining budget.
+ * Holders only keep their locks for a short time, so that a held lock often becomes free within a few spins.
+ * @param spins remaining budget in pauses, decremented by the pauses spent
+ * @return Whether the lock is free
+ */
+bool v_lock_wait(v_lock_t* lock, unsigned *spins);
 
 /**
  * Release lock
@@ -42,12 +52,28 @@ void v_lock_release(v_lock_t* lock);
 /**
  * Update version of the lock and release it
  */
-void v_lock_release_and_update(v_lock_t* lock, int val);
+void v_lock_release_and_update(v_lock_t* lock, version_t val);
 
 /**
  * Get version of the lock
  */
-int v_lock_version(v_lock_t* lock);
+version_t v_lock_version(v_lock_t* lock);
+
+/**
+ * Get version of a lock held by the caller (the version it had when it was acquired)
+ */
+version_t v_lock_owned_version(v_lock_t* lock);
+
+/**
+ * Get version of the lock, reading through it if owner holds it
+ * @return Version, LOCKED if another thread holds the lock
+ */
+version_t v_lock_version_for(v_lock_t* lock, unsigned owner);
+
+/**
+ * @return Id of the thread holding the lock, 0 if it is free
+ */
+unsigned v_lock_owner(v_lock_t* lock);
 
 // ============= Global clock implementation ============= 
 /**
@@ -55,10 +81,36 @@ int v_lock_version(v_lock_t* lock);
  */
 typedef version_clock_t global_clock_t;
 
+/**
+ * @brief How commits get their write version from the global clock (see "Transactional Locking II").
+ * A commit always holds the locks of its write set when it gets its version, so that a reader whose
+ * snapshot covers a version that is still being written back finds its stripes locked.
+ */
+enum clock_scheme_t {
+    CLOCK_GV1,  // Every commit increments the clock: write versions are unique
+    CLOCK_GV4,  // A commit that loses the race to increment the clock shares the version of the winner
+    CLOCK_GV5,  // Commits use clock + 1 without writing the clock; readers that see a newer version push it forward
+                // (long read-only transactions then abort on almost every concurrent commit)
+    CLOCK_GV6,  // GV5, except for one commit out of CLOCK_GV6_PERIOD per thread and region, which increments the clock
+};
+
 void global_clock_init(global_clock_t *global_clock);
 
 void global_clock_cleanup(global_clock_t *global_clock);
 
-int global_clock_load(global_clock_t *global_clock);
+version_t global_clock_load(global_clock_t *global_clock);
+
+version_t global_clock_increment_and_fetch(global_clock_t *global_clock);
 
-int global_clock_increment_and_fetch(global_clock_t *global_clock);
+/**
+ * Get the write version of a commit
+ * @param scheme the clock scheme of the region
+ * @param exclusive set to whether no other commit can get the same version (may be NULL)
+ * @return Write version, greater than every version the clock held before
+ */
+version_t global_clock_next_version(global_clock_t *global_clock, enum clock_scheme_t scheme, bool *exclusive);
+
+/**
+ * Move the clock forward to version, if it is behind (GV5, GV6: lock versions may be ahead of the clock)
+ */
+void global_clock_advance(global_clock_t *global_clock, version_t version);
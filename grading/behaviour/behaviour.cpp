@@ -0,0 +1,480 @@
+/**
+ * @file   behaviour.cpp
+ *
+ * @section DESCRIPTION
+ *
+ * Behaviour checks of the implementations: every engine and the settings selected through the
+ * environment (see 318049/helper.h) run against the same transactional interface as the grading.
+**/
+
+// External headers
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+extern "C" {
+#include <dlfcn.h>
+}
+
+// Internal headers
+#include "../common.hpp"
+#include "../transactional.hpp"
+#include "../workload.hpp"
+
+// -------------------------------------------------------------------------- //
+
+namespace Exception {
+EXCEPTION(Behaviour, Any, "Behaviour check failed");
+    EXCEPTION(TransferInvariant, Behaviour, "Concurrent transfers broke the total balance");
+    EXCEPTION(AllocRollback, Behaviour, "Allocations of aborted transactions were not rolled back");
+    EXCEPTION(WriteRollback, Behaviour, "Writes of aborted transactions were not rolled back");
+    EXCEPTION(SlabRegions, Behaviour, "Incorrect RW with segments of many regions");
+    EXCEPTION(PooledRegion, Behaviour, "A reused region was not cleared");
+    EXCEPTION(SegmentIds, Behaviour, "Incorrect handling of segment id exhaustion");
+    EXCEPTION(HugeCoverage, Behaviour, "Incorrect huge-page coverage report");
+}
+
+/** Engines selectable with TM_ENGINE.
+**/
+static constexpr ::std::array<char const*, 5> engines{"tl2", "tl2-mv", "tl2-eager", "norec", "dv"};
+
+/** Set the environment read by the library at region creation for the lifetime of the instance.
+**/
+class Setting final: private NonCopyable {
+private:
+    char const* name;
+public:
+    Setting(char const* name, char const* value): name{name} {
+        ::setenv(name, value, 1);
+    }
+    ~Setting() {
+        ::unsetenv(name);
+    }
+};
+
+/** Run a check, printing its duration.
+ * @param title Check description
+ * @param dur   Maximum execution duration
+ * @param func  Check to run (void -> void)
+**/
+template<class Rep, class Period, class Func> static void check(char const* title, ::std::chrono::duration<Rep, Period> const& dur, Func&& func) {
+    bounded_run(dur, [&] {
+        auto t1 = ::std::chrono::steady_clock::now();
+        ::std::cout << "⎪ " << title << "..." << ::std::endl;
+        func();
+        auto t2 = ::std::chrono::steady_clock::now();
+        ::std::cout << "⎪ Checked in " << ::std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " ms" << ::std::endl;
+    }, title);
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Concurrent transfers between accounts, some allocating and freeing a segment, while read-only
+ * transactions check that the total balance never changes.
+**/
+static void check_transfers(TransactionalLibrary& tl, Seed seed) {
+    size_t constexpr accounts = 16;
+    uint64_t constexpr balance = 100;
+    unsigned int constexpr workers = 4;
+    unsigned int constexpr transfers = 2000;
+    TransactionalMemory tm{tl, sizeof(uint64_t), accounts * sizeof(uint64_t)};
+    auto* start = static_cast<uint64_t*>(tm.get_start());
+    transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+        for (size_t i = 0; i < accounts; i++)
+            tx.write(&balance, sizeof(balance), start + i);
+    });
+    ::std::atomic<bool> broken{false};
+    ::std::vector<::std::thread> threads;
+    for (unsigned int w = 0; w < workers; w++) {
+        threads.emplace_back([&, w]() {
+            ::std::minstd_rand rng{seed + w};
+            ::std::uniform_int_distribution<size_t> account_dist(0, accounts - 1);
+            void* segment = nullptr;
+            for (unsigned int t = 0; t < transfers; t++) {
+                auto from = account_dist(rng), to = account_dist(rng);
+                segment = transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+                    uint64_t a, b;
+                    tx.read(start + from, sizeof(a), &a);
+                    tx.read(start + to, sizeof(b), &b);
+                    if (from != to && a > 0) {
+                        a--;
+                        b++;
+                        tx.write(&a, sizeof(a), start + from);
+                        tx.write(&b, sizeof(b), start + to);
+                    }
+                    if (t % 16 != 0)
+                        return segment;
+                    if (segment)
+                        tx.free(segment);
+                    auto* fresh = tx.alloc(sizeof(uint64_t));
+                    tx.write(&a, sizeof(a), fresh);
+                    return fresh;
+                });
+                if (t % 64 == 0) {
+                    auto total = transactional(tm, Transaction::Mode::read_only, [&](auto& tx) {
+                        uint64_t sum = 0;
+                        for (size_t i = 0; i < accounts; i++) {
+                            uint64_t a;
+                            tx.read(start + i, sizeof(a), &a);
+                            sum += a;
+                        }
+                        return sum;
+                    });
+                    if (total != accounts * balance)
+                        broken.store(true, ::std::memory_order_relaxed);
+                }
+            }
+            if (segment) {
+                transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+                    tx.free(segment);
+                });
+            }
+        });
+    }
+    for (auto& thread: threads)
+        thread.join();
+    if (broken.load(::std::memory_order_relaxed))
+        throw Exception::TransferInvariant();
+}
+
+/** Abort transactions that wrote a word several times: the word must get back its committed value.
+ * Skipped for the batching engine (dv), as check_alloc_rollback.
+**/
+static void check_write_rollback(TransactionalLibrary& tl) {
+    size_t constexpr rounds = 1000;
+    TransactionalMemory tm{tl, sizeof(uint64_t), 4096};
+    auto* read_word = static_cast<uint64_t*>(tm.get_start());
+    auto* written_word = read_word + 256;
+    uint64_t committed = 0;
+    for (uint64_t i = 1; i <= rounds; i++) {
+        auto victim = tm.begin(false);
+        uint64_t read, value = i;
+        if (victim == STM::invalid_tx || !tm.read(victim, read_word, sizeof(read), &read))
+            throw Exception::WriteRollback();
+        bool running = tm.write(victim, &value, sizeof(value), written_word);
+        value = ~i;
+        running = running && tm.write(victim, &value, sizeof(value), written_word);
+        // Overwrite what the victim read, so that it fails to commit
+        transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+            tx.write(&i, sizeof(i), read_word);
+        });
+        if (running && tm.end(victim))
+            committed = value;
+        transactional(tm, Transaction::Mode::read_only, [&](auto& tx) {
+            tx.read(written_word, sizeof(read), &read);
+        });
+        if (read != committed)
+            throw Exception::WriteRollback();
+    }
+}
+
+/** Abort transactions that allocated a segment (small or mapped), more times than there are segment
+ * ids: their segments, and ids, must come back. The batching engine (dv) can't run two transactions
+ * in one thread and is skipped.
+**/
+static void check_alloc_rollback(TransactionalLibrary& tl) {
+    size_t constexpr rounds = 70000;
+    TransactionalMemory tm{tl, sizeof(uint64_t), sizeof(uint64_t)};
+    auto* word = tm.get_start();
+    size_t aborted = 0;
+    for (uint64_t i = 0; i < rounds; i++) {
+        auto victim = tm.begin(false);
+        uint64_t read;
+        if (victim == STM::invalid_tx || !tm.read(victim, word, sizeof(read), &read))
+            throw Exception::AllocRollback();
+        // Overwrite what the victim read, so that it fails to commit
+        transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+            tx.write(&i, sizeof(i), word);
+        });
+        void* segment;
+        size_t size = i % 256 == 0 ? 1024 * 1024 : sizeof(uint64_t);
+        switch (tm.alloc(victim, size, &segment)) {
+        case STM::Alloc::success:
+            break;
+        case STM::Alloc::abort:
+            aborted++;
+            continue;
+        default:
+            throw Exception::AllocRollback();
+        }
+        if (!tm.write(victim, &i, sizeof(i), segment)) {
+            aborted++;
+            continue;
+        }
+        if (!tm.end(victim)) {
+            aborted++;
+            continue;
+        }
+        transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+            tx.free(segment);
+        });
+    }
+    if (aborted == 0)
+        throw Exception::AllocRollback();
+    transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+        tx.free(tx.alloc(sizeof(uint64_t)));
+    });
+}
+
+/** Allocate and free small segments in more regions than a thread caches slabs for, destroying and
+ * recreating some regions while the threads still hold cached chunks of them.
+**/
+static void check_slab_regions(TransactionalLibrary& tl) {
+    size_t constexpr regions = 8;
+    size_t constexpr segments = 64;
+    unsigned int constexpr workers = 4;
+    unsigned int constexpr rounds = 16;
+    ::std::array<::std::unique_ptr<TransactionalMemory>, regions> tms;
+    for (auto& tm: tms)
+        tm = ::std::make_unique<TransactionalMemory>(tl, sizeof(uint64_t), sizeof(uint64_t));
+    Barrier barrier{workers + 1};
+    ::std::atomic<bool> broken{false};
+    ::std::vector<::std::thread> threads;
+    for (unsigned int w = 0; w < workers; w++) {
+        threads.emplace_back([&, w]() {
+            for (unsigned int r = 0; r < rounds; r++) {
+                barrier.sync();
+                ::std::array<::std::array<void*, segments>, regions> allocated;
+                for (size_t s = 0; s < segments; s++) {
+                    for (size_t g = 0; g < regions; g++) {
+                        uint64_t value = (uint64_t) w << 32 | g << 16 | s;
+                        allocated[g][s] = transactional(*tms[g], Transaction::Mode::read_write, [&](auto& tx) {
+                            auto* segment = tx.alloc(16 + 16 * (s % 4));
+                            tx.write(&value, sizeof(value), segment);
+                            return segment;
+                        });
+                    }
+                }
+                for (size_t g = 0; g < regions; g++) {
+                    for (size_t s = 0; s < segments; s++) {
+                        uint64_t value = (uint64_t) w << 32 | g << 16 | s, read;
+                        transactional(*tms[g], Transaction::Mode::read_write, [&](auto& tx) {
+                            tx.read(allocated[g][s], sizeof(read), &read);
+                            tx.free(allocated[g][s]);
+                        });
+                        if (read != value)
+                            broken.store(true, ::std::memory_order_relaxed);
+                    }
+                }
+                barrier.sync();
+            }
+        });
+    }
+    for (unsigned int r = 0; r < rounds; r++) {
+        barrier.sync();
+        barrier.sync();
+        for (size_t g = r % 2; g < regions; g += 2)
+            tms[g] = ::std::make_unique<TransactionalMemory>(tl, sizeof(uint64_t), sizeof(uint64_t));
+    }
+    for (auto& thread: threads)
+        thread.join();
+    if (broken.load(::std::memory_order_relaxed))
+        throw Exception::SlabRegions();
+}
+
+/** Destroy dirty regions and create new ones of the same shape: the base segment must read as zero.
+**/
+static void check_pooled_regions(TransactionalLibrary& tl) {
+    for (size_t const size: {sizeof(uint64_t) * 64, size_t{1} << 20}) {
+        for (int r = 0; r < 8; r++) {
+            TransactionalMemory tm{tl, sizeof(uint64_t), size};
+            auto* start = static_cast<uint8_t*>(tm.get_start());
+            transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+                for (size_t offset = 0; offset < size; offset += 4096 / 4) {
+                    uint64_t word;
+                    tx.read(start + offset, sizeof(word), &word);
+                    if (word != 0)
+                        throw Exception::PooledRegion();
+                    word = ~offset;
+                    tx.write(&word, sizeof(word), start + offset);
+                }
+                uint64_t word = size;
+                tx.write(&word, sizeof(word), tx.alloc(sizeof(word)));
+            });
+        }
+    }
+}
+
+/** Allocate more segments than there are segment ids: once they run out, co-located regions fail the
+ * allocation cleanly, the others hand out plain addresses; every segment keeps its content.
+**/
+static void check_segment_ids(TransactionalLibrary& tl, bool colocated) {
+    size_t constexpr count = 70000;
+    ::std::vector<void*> segments;
+    TransactionalMemory tm{tl, sizeof(uint64_t), sizeof(uint64_t)};
+    bool exhausted = false;
+    for (uint64_t i = 0; i < count && !exhausted; i++) {
+        try {
+            segments.push_back(transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+                auto* segment = tx.alloc(sizeof(uint64_t));
+                tx.write(&i, sizeof(i), segment);
+                return segment;
+            }));
+        } catch (Exception::TransactionAlloc const&) {
+            exhausted = true;
+        }
+    }
+    if (exhausted && (!colocated || segments.empty()))
+        throw Exception::SegmentIds();
+    for (uint64_t i = 0; i < segments.size(); i++) {
+        uint64_t read;
+        transactional(tm, Transaction::Mode::read_only, [&](auto& tx) {
+            tx.read(segments[i], sizeof(read), &read);
+        });
+        if (read != i)
+            throw Exception::SegmentIds();
+    }
+    // Freed ids are handed out again once reclaimed
+    for (auto* segment: segments) {
+        transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+            tx.free(segment);
+        });
+    }
+    for (size_t i = 0; i < segments.size() / 2; i++) {
+        segments[i] = transactional(tm, Transaction::Mode::read_write, [&](auto& tx) {
+            return tx.alloc(sizeof(uint64_t));
+        });
+    }
+}
+
+/** Populate a region created with huge pages, then report the coverage it achieved through the
+ * library's own query (region_huge_stats, TL2 regions only), if it has one.
+ * @param path Path of the library, already loaded
+**/
+static void check_huge_coverage(char const* path) {
+    struct HugeStats { // Mirrors struct region_huge_stats_t
+        size_t mapped_size;
+        size_t huge_size;
+    };
+    auto* handle = ::dlopen(path, RTLD_LAZY | RTLD_NOLOAD);
+    if (unlikely(!handle))
+        throw Exception::ModuleLoading();
+    auto huge_stats = reinterpret_cast<void (*)(STM::shared_t, HugeStats*)>(::dlsym(handle, "region_huge_stats"));
+    if (!huge_stats) {
+        ::std::cout << "⎪ Skipped: no coverage query" << ::std::endl;
+        ::dlclose(handle);
+        return;
+    }
+    size_t constexpr size = 64 * 1024 * 1024;
+    auto create = reinterpret_cast<decltype(&STM::tm_create)>(::dlsym(handle, "tm_create"));
+    auto destroy = reinterpret_cast<decltype(&STM::tm_destroy)>(::dlsym(handle, "tm_destroy"));
+    auto start = reinterpret_cast<decltype(&STM::tm_start)>(::dlsym(handle, "tm_start"));
+    auto begin = reinterpret_cast<decltype(&STM::tm_begin)>(::dlsym(handle, "tm_begin"));
+    auto write = reinterpret_cast<decltype(&STM::tm_write)>(::dlsym(handle, "tm_write"));
+    auto end = reinterpret_cast<decltype(&STM::tm_end)>(::dlsym(handle, "tm_end"));
+    auto shared = create(size, sizeof(uint64_t));
+    if (unlikely(shared == STM::invalid_shared))
+        throw Exception::TransactionCreate();
+    auto* base = static_cast<uint8_t*>(start(shared));
+    for (size_t offset = 0; offset < size;) {
+        auto tx = begin(shared, false);
+        bool committed = true;
+        for (size_t page = 0; committed && page < 256 && offset + page * 4096 < size; page++)
+            committed = write(shared, tx, &offset, sizeof(offset), base + offset + page * 4096);
+        if (committed && end(shared, tx))
+            offset += 256 * 4096;
+    }
+    HugeStats stats;
+    huge_stats(shared, &stats);
+    destroy(shared);
+    ::dlclose(handle);
+    ::std::cout << "⎪ " << stats.huge_size << " of " << stats.mapped_size << " mapped bytes backed by huge pages" << ::std::endl;
+    if (stats.mapped_size < size || stats.huge_size > stats.mapped_size)
+        throw Exception::HugeCoverage();
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Run every check on one library.
+ * @param path Path of the library
+ * @param tl   Transactional library, loaded from path
+ * @param seed Seed of the workloads
+ * @return Whether every check passed
+**/
+static bool check_library(char const* path, TransactionalLibrary& tl, Seed seed) {
+    try {
+        for (auto const* engine: engines) {
+            Setting setting{"TM_ENGINE", engine};
+            ::std::cout << "⎪ Engine '" << engine << "'" << ::std::endl;
+            check("Checking concurrent transfers", ::std::chrono::seconds(60), [&] {
+                check_transfers(tl, seed);
+            });
+            check("Checking whether aborted allocations are rolled back", ::std::chrono::seconds(60), [&] {
+                if (::std::strcmp(engine, "dv") == 0) {
+                    ::std::cout << "⎪ Skipped: transactions of one thread share an epoch" << ::std::endl;
+                    return;
+                }
+                Setting ids{"TM_SEGMENT_IDS", "1"};
+                Setting colocated{"TM_COLOCATED", "1"};
+                check_alloc_rollback(tl);
+            });
+            check("Checking whether aborted writes are rolled back", ::std::chrono::seconds(60), [&] {
+                if (::std::strcmp(engine, "dv") == 0) {
+                    ::std::cout << "⎪ Skipped: transactions of one thread share an epoch" << ::std::endl;
+                    return;
+                }
+                check_write_rollback(tl);
+            });
+            check("Checking whether destroyed regions are reused cleared", ::std::chrono::seconds(60), [&] {
+                check_pooled_regions(tl);
+            });
+        }
+        check("Checking small segments across many regions", ::std::chrono::seconds(60), [&] {
+            check_slab_regions(tl);
+        });
+        for (bool const colocated: {false, true}) {
+            check(colocated ? "Checking segment id exhaustion (co-located)" : "Checking segment id exhaustion", ::std::chrono::seconds(60), [&] {
+                Setting ids{"TM_SEGMENT_IDS", "1"};
+                Setting layout{"TM_COLOCATED", colocated ? "1" : "0"};
+                check_segment_ids(tl, colocated);
+            });
+        }
+        check("Checking huge-page coverage", ::std::chrono::seconds(60), [&] {
+            Setting engine{"TM_ENGINE", "tl2"};
+            Setting huge{"TM_HUGE_PAGES", "1"};
+            check_huge_coverage(path);
+        });
+        return true;
+    } catch (::std::exception const& err) {
+        ::std::cerr << "⎪⎧ *** EXCEPTION ***" << ::std::endl << "⎪⎩ " << err.what() << ::std::endl;
+        return false;
+    }
+}
+
+/** Program entry point.
+ * @param argc Arguments count
+ * @param argv Arguments values
+ * @return Program return code
+**/
+int main(int argc, char** argv) {
+    try {
+        if (argc < 3) {
+            ::std::cout << "Usage: " << (argc > 0 ? argv[0] : "behaviour") << " <seed> <tested library path>..." << ::std::endl;
+            return 1;
+        }
+        auto const seed = static_cast<Seed>(::std::stoul(argv[1]));
+        for (auto i = 2; i < argc; ++i) {
+            ::std::cout << "⎧ Checking the behaviour of '" << argv[i] << "'..." << ::std::endl;
+            TransactionalLibrary tl{argv[i]};
+            if (unlikely(!check_library(argv[i], tl, seed))) {
+                ::std::cout << "⎩ Behaviour check failed" << ::std::endl;
+                return 1;
+            }
+            ::std::cout << "⎩ All behaviour checks passed" << ::std::endl;
+        }
+        return 0;
+    } catch (::std::exception const& err) {
+        ::std::cerr << "⎧ *** EXCEPTION ***" << ::std::endl;
+        ::std::cerr << "⎩ " << err.what() << ::std::endl;
+        return 1;
+    }
+}